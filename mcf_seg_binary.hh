@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// A binary form of SEG data, which can be used without parsing it:
+// the file is memory-mapped, so several programs reading the same file
+// share one copy of it.  The records are in seg-sort order, and each
+// sequence name is stored once.
+
+// The file has: a SegBinaryHeader, the end of each name in the name
+// text, one SegBinaryRecord per record plus one more (whose partBeg is
+// the total number of parts), the SegBinaryParts, and the name text.
+// Numbers are 64-bit, in the computer's own byte order.
+
+#ifndef MCF_SEG_BINARY_HH
+#define MCF_SEG_BINARY_HH
+
+#include "mcf_seg_join.hh"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mcf {
+
+const char segBinaryMagic[8] = {'S', 'E', 'G', 'B', 'I', 'N', '1', '\n'};
+const uint64_t segBinaryByteOrder = 0x0102030405060708ULL;
+
+struct SegBinaryHeader {
+  char magic[8];
+  uint64_t byteOrder;
+  uint64_t numOfNames;
+  uint64_t nameTextSize;
+  uint64_t numOfRecords;
+  uint64_t numOfParts;
+};
+
+struct SegBinaryRecord {
+  int64_t length;
+  uint64_t partBeg;
+};
+
+struct SegBinaryPart {
+  uint64_t nameNum;
+  int64_t start;
+};
+
+// Does the file start like a binary SEG file?  Only regular files are
+// checked, because reading the start of a pipe (such as "-" or
+// /dev/fd/N) would lose it.
+inline bool isSegBinaryFile(const char *fileName) {
+  if (isChar(fileName, '-')) return false;
+  struct stat st;
+  if (stat(fileName, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  std::ifstream f(fileName, std::ios::binary);
+  char magic[sizeof segBinaryMagic];
+  return f.read(magic, sizeof magic) &&
+    std::memcmp(magic, segBinaryMagic, sizeof magic) == 0;
+}
+
+// Gathers SEG lines, and writes them as a binary SEG file when finish
+// is called
+class SegBinaryOutput : public SegTextOutput {
+public:
+  explicit SegBinaryOutput(const std::string &fileName)
+    : fileName(fileName) {}
+
+  void write(const char *beg, size_t size) {
+    line.assign(beg, size);
+    if (!isDataLine(line.c_str())) return;
+    parseSeg(StringView(line), recentNames, seg);
+    SegBinaryRecord r = {end0(seg) - beg0(seg), parts.size()};
+    records.push_back(r);
+    for (size_t i = 0; i < seg.parts.size(); ++i) {
+      StringView n = seqName(seg, i);
+      key.assign(n.begin(), n.end());
+      NameNums::iterator f = nameNums.find(key);
+      if (f == nameNums.end()) {
+	f = nameNums.insert(std::make_pair(key, names.size())).first;
+	names.push_back(key);
+      }
+      SegBinaryPart q = {f->second, static_cast<int64_t>(seg.parts[i].start)};
+      parts.push_back(q);
+    }
+  }
+
+  void finish() {
+    std::vector<size_t> order(records.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    IsRecordLess isLess = {this};
+    std::stable_sort(order.begin(), order.end(), isLess);
+
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    if (!out) err("can't open file: " + fileName);
+    SegBinaryHeader h;
+    std::memcpy(h.magic, segBinaryMagic, sizeof h.magic);
+    h.byteOrder = segBinaryByteOrder;
+    h.numOfNames = names.size();
+    h.nameTextSize = 0;
+    h.numOfRecords = records.size();
+    h.numOfParts = parts.size();
+    std::vector<uint64_t> nameEnds;
+    for (size_t i = 0; i < names.size(); ++i) {
+      h.nameTextSize += names[i].size();
+      nameEnds.push_back(h.nameTextSize);
+    }
+    put(out, &h, 1);
+    put(out, nameEnds.data(), nameEnds.size());
+
+    uint64_t partBeg = 0;
+    for (size_t i = 0; i <= order.size(); ++i) {
+      SegBinaryRecord r = {0, partBeg};
+      if (i < order.size()) {
+	r.length = records[order[i]].length;
+	partBeg += partEnd(order[i]) - records[order[i]].partBeg;
+      }
+      put(out, &r, 1);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+      size_t b = records[order[i]].partBeg;
+      put(out, parts.data() + b, partEnd(order[i]) - b);
+    }
+    for (size_t i = 0; i < names.size(); ++i)
+      put(out, names[i].data(), names[i].size());
+
+    out.close();
+    if (!out) err("can't write file: " + fileName);
+  }
+
+private:
+  typedef std::unordered_map<std::string, uint64_t> NameNums;
+
+  std::string fileName;
+  std::string line;
+  RecentNames recentNames;
+  Seg seg;
+  std::vector<SegBinaryRecord> records;
+  std::vector<SegBinaryPart> parts;
+  std::vector<std::string> names;
+  NameNums nameNums;
+  std::string key;  // reused, to avoid allocating memory for lookups
+
+  size_t partEnd(size_t recordNum) const {
+    return recordNum + 1 < records.size()
+      ? records[recordNum + 1].partBeg : parts.size();
+  }
+
+  // seg-sort order: first sequence name, then first start coordinate
+  struct IsRecordLess {
+    const SegBinaryOutput *o;
+    bool operator()(size_t x, size_t y) const {
+      const SegBinaryPart &a = o->parts[o->records[x].partBeg];
+      const SegBinaryPart &b = o->parts[o->records[y].partBeg];
+      if (a.nameNum != b.nameNum) {
+	int c = o->names[a.nameNum].compare(o->names[b.nameNum]);
+	if (c) return c < 0;
+      }
+      return a.start < b.start;
+    }
+  };
+
+  template<typename T> static void put(std::ostream &out, const T *x,
+				       size_t n) {
+    out.write(reinterpret_cast<const char *>(x), n * sizeof(T));
+  }
+};
+
+// A memory-mapped binary SEG file, whose names are hashed when it's
+// opened
+class SegBinaryFile {
+public:
+  explicit SegBinaryFile(const char *fileName) : fileName(fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) err("can't open file: " + this->fileName);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      void *m = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+      data = (m == MAP_FAILED) ? 0 : static_cast<const char *>(m);
+    } else {
+      data = 0;
+    }
+    close(fd);
+    if (!data) err("can't read file: " + this->fileName);
+    setUp();
+  }
+
+  ~SegBinaryFile() { munmap(const_cast<char *>(data), size); }
+
+  size_t numOfRecords() const { return header->numOfRecords; }
+
+  // Sets s to record number i
+  void get(size_t i, Seg &s) const {
+    const SegBinaryRecord &r = records[i];
+    uint64_t e = records[i + 1].partBeg;
+    if (r.partBeg >= e || e > header->numOfParts) bad();
+    s.parts.clear();
+    s.names.clear();
+    for (uint64_t j = r.partBeg; j < e; ++j) {
+      const SegBinaryPart &p = parts[j];
+      if (p.nameNum >= names.size()) bad();
+      StringView n = names[p.nameNum];
+      addSegPart(s, n.begin(), n.end(), nameHashes[p.nameNum], p.start);
+    }
+    setSegLength(s, r.length);
+  }
+
+private:
+  std::string fileName;
+  const char *data;
+  size_t size;
+  const SegBinaryHeader *header;
+  const SegBinaryRecord *records;
+  const SegBinaryPart *parts;
+  std::vector<StringView> names;
+  std::vector<Hash> nameHashes;
+
+  void bad() const { err("bad binary SEG file: " + fileName); }
+
+  void setUp() {
+    header = reinterpret_cast<const SegBinaryHeader *>(data);
+    if (size < sizeof *header ||
+	std::memcmp(header->magic, segBinaryMagic, sizeof header->magic))
+      bad();
+    if (header->byteOrder != segBinaryByteOrder)
+      err("binary SEG file from a different kind of computer: " + fileName);
+    const SegBinaryHeader &h = *header;
+    size_t rest = size - sizeof h;
+    if (h.numOfNames > rest / 8) bad();
+    rest -= h.numOfNames * 8;
+    if (h.numOfRecords >= rest / sizeof(SegBinaryRecord)) bad();
+    rest -= (h.numOfRecords + 1) * sizeof(SegBinaryRecord);
+    if (h.numOfParts > rest / sizeof(SegBinaryPart)) bad();
+    rest -= h.numOfParts * sizeof(SegBinaryPart);
+    if (h.nameTextSize != rest) bad();
+
+    const uint64_t *nameEnds = reinterpret_cast<const uint64_t *>(header + 1);
+    records = reinterpret_cast<const SegBinaryRecord *>(nameEnds +
+							h.numOfNames);
+    parts = reinterpret_cast<const SegBinaryPart *>(records +
+						    h.numOfRecords + 1);
+    const char *nameText = reinterpret_cast<const char *>(parts +
+							  h.numOfParts);
+    uint64_t beg = 0;
+    for (size_t i = 0; i < h.numOfNames; ++i) {
+      if (nameEnds[i] < beg || nameEnds[i] > h.nameTextSize) bad();
+      const char *b = nameText + beg;
+      const char *e = nameText + nameEnds[i];
+      names.push_back(StringView(b, e));
+      nameHashes.push_back(nameHash(b, e));
+      beg = nameEnds[i];
+    }
+    if (records[h.numOfRecords].partBeg != h.numOfParts) bad();
+  }
+};
+
+// Gets segment-tuples from a binary SEG file, in order
+class SegBinarySource : public SegSource {
+public:
+  explicit SegBinarySource(const SegBinaryFile &file)
+    : file(file), recordNum(0) {}
+
+  bool read(Seg &s) {
+    if (recordNum == file.numOfRecords()) return false;
+    file.get(recordNum++, s);
+    return true;
+  }
+
+private:
+  const SegBinaryFile &file;
+  size_t recordNum;
+};
+
+}
+
+#endif
@@ -0,0 +1,1203 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Converting segments and alignments, in various formats, to SEG
+// records.  This is what seg-import does, but it can also be used
+// directly from other programs: the records go to any SegImportSink.
+
+#ifndef MCF_SEG_IMPORT_HH
+#define MCF_SEG_IMPORT_HH
+
+#include "mcf_seg_io.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <stddef.h>  // size_t
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mcf {
+
+struct SegImportOptions {
+  unsigned forwardSegNum;
+  bool isAddAlignmentNum;
+  bool isCds;
+  bool is5utr;
+  bool is3utr;
+  bool isIntrons;
+  bool isPrimaryTranscripts;
+  unsigned numOfThreads;
+  std::vector<const char *> mafRowNamePrefixes;
+  unsigned samSkipFlags;  // skip SAM records with any of these flag bits
+  unsigned samMinMapq;    // skip SAM records with lower mapping quality
+};
+
+struct SegRecordPart {
+  StringView seqName;
+  long start;
+};
+
+// One SEG line: the names point into text owned by whoever made it
+struct SegRecord {
+  long length;
+  std::vector<SegRecordPart> parts;
+
+  void clear(long len) {
+    length = len;
+    parts.clear();
+  }
+
+  void add(StringView seqName, long start) {
+    SegRecordPart p;
+    p.seqName = seqName;
+    p.start = start;
+    parts.push_back(p);
+  }
+};
+
+// Receives imported records
+class SegImportSink {
+public:
+  virtual ~SegImportSink() {}
+
+  virtual void putRecord(const SegRecord &r) = 0;
+
+  // Called at places in the input where importing could restart, with
+  // no state except alnNum (e.g. to make checkpoints)
+  virtual void mark(const LineReader &in, size_t alnNum) {}
+
+  // Gets an empty record, which can be filled in and then put
+  SegRecord &newRecord(long length) {
+    record.clear(length);
+    return record;
+  }
+
+  void putSeg(long length, StringView name1, long start1) {
+    newRecord(length).add(name1, start1);
+    putRecord(record);
+  }
+
+  void putSeg(long length, StringView name1, long start1,
+	      StringView name2, long start2) {
+    newRecord(length).add(name1, start1);
+    record.add(name2, start2);
+    putRecord(record);
+  }
+
+private:
+  SegRecord record;
+};
+
+// Writes imported records as SEG text
+class SegImportWriter : public SegImportSink {
+public:
+  explicit SegImportWriter(SegTextOutput &out) : out(out) {}
+
+  void putRecord(const SegRecord &r) {
+    size_t size = maxLongTextSize + 1;
+    for (size_t i = 0; i < r.parts.size(); ++i)
+      size += r.parts[i].seqName.size() + 1 + maxLongTextSize;
+    buffer.resize(size);
+    char *bufferEnd = &buffer.back() + 1;
+    char *e = bufferEnd;
+    *--e = '\n';
+    for (size_t i = r.parts.size(); i --> 0; ) {
+      const SegRecordPart &p = r.parts[i];
+      e = writeLong(e, p.start);
+      *--e = '\t';
+      e -= p.seqName.size();
+      std::memcpy(e, p.seqName.data(), p.seqName.size());
+      *--e = '\t';
+    }
+    e = writeLong(e, r.length);
+    out.write(e, bufferEnd - e);
+  }
+
+private:
+  SegTextOutput &out;
+  std::vector<char> buffer;
+};
+
+// Keeps copies of records, so they can be put somewhere later
+class SegRecordBuffer : public SegImportSink {
+public:
+  void putRecord(const SegRecord &r) {
+    numbers.push_back(r.length);
+    numbers.push_back(r.parts.size());
+    for (size_t i = 0; i < r.parts.size(); ++i) {
+      const SegRecordPart &p = r.parts[i];
+      names.append(p.seqName.begin(), p.seqName.end());
+      numbers.push_back(p.seqName.size());
+      numbers.push_back(p.start);
+    }
+  }
+
+  void replay(SegImportSink &sink) const {
+    const char *n = names.data();
+    for (size_t i = 0; i < numbers.size(); ) {
+      SegRecord &r = sink.newRecord(numbers[i++]);
+      long numOfParts = numbers[i++];
+      for (long j = 0; j < numOfParts; ++j) {
+	const char *e = n + numbers[i++];
+	r.add(StringView(n, e), numbers[i++]);
+	n = e;
+      }
+      sink.putRecord(r);
+    }
+  }
+
+  void clear() {
+    numbers.clear();
+    names.clear();
+  }
+
+private:
+  std::vector<long> numbers;
+  std::string names;
+};
+
+// Writes x into buf, and returns a view of the text
+inline StringView numberText(char (&buf)[maxLongTextSize], long x) {
+  char *e = buf + maxLongTextSize;
+  return StringView(writeLong(e, x), e);
+}
+
+inline void makeLowercase(std::string &s) {
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = s[i];
+    s[i] = std::tolower(c);
+  }
+}
+
+inline bool isGraphOrSpace(char c) {
+  return c >= ' ';
+}
+
+inline StringView &getWordWithSpaces(StringView &in, StringView &out) {
+  const char *b = in.begin();
+  const char *e = in.end();
+  while (true) {
+    if (b == e) return in = StringView();
+    if (isGraphOrSpace(*b)) break;
+    ++b;
+  }
+  const char *m = b;
+  do { ++m; } while (m < e && isGraphOrSpace(*m));
+  out = StringView(b, m);
+  return in = StringView(m, e);
+}
+
+// Gets the next line, after marking the place before it
+inline bool getMarkedLine(LineReader &in, StringView &line,
+			  size_t alnNum, SegImportSink &out) {
+  out.mark(in, alnNum);
+  return in.getLine(line);
+}
+
+inline bool isStrand(char c) {
+  return c == '+' || c == '-';
+}
+
+inline void importChain(LineReader &in, const SegImportOptions &opts,
+			SegImportSink &out) {
+  StringView word, tName, tStrand, qName, qStrand;
+  long tPos = 0;
+  long qPos = 0;
+  bool isFlip = false;
+  StringView line;
+  std::string chainLine;
+  while (in.getLine(line)) {
+    StringView s = line;
+    s >> word;
+    if (!s || word[0] == '#') continue;
+    if (word == "chain") {
+      chainLine.assign(line.begin(), line.end());
+      StringView t(chainLine);
+      long tSize, qSize;
+      t >> word >> word >> tName >> tSize >> tStrand >> tPos
+	>> word >> qName >> qSize >> qStrand >> qPos;
+      if (!t) err("bad CHAIN line: " + chainLine);
+      if (tStrand == '-') tPos -= tSize;
+      if (qStrand == '-') qPos -= qSize;
+      isFlip = ((opts.forwardSegNum == 1 && tPos < 0) ||
+		(opts.forwardSegNum == 2 && qPos < 0));
+    } else {
+      StringView t = line;
+      long size, tInc, qInc;
+      t >> size;
+      if (!t) err("bad CHAIN line: " + line);
+      long tBeg = isFlip ? -(tPos + size) : tPos;
+      long qBeg = isFlip ? -(qPos + size) : qPos;
+      out.putSeg(size, tName, tBeg, qName, qBeg);
+      if (t >> tInc >> qInc) {
+	tPos += size + tInc;
+	qPos += size + qInc;
+      } else {
+	out.mark(in, 0);  // the end of a chain
+      }
+    }
+  }
+}
+
+inline void importGff(LineReader &in, const SegImportOptions &opts,
+		      SegImportSink &out) {
+  StringView seqname, junk, strand;
+  StringView line;
+  while (getMarkedLine(in, line, 0, out)) {
+    StringView s = line;
+    s >> seqname;
+    if (!s || seqname[0] == '#') continue;
+    getWordWithSpaces(s, junk);
+    getWordWithSpaces(s, junk);
+    long beg, end;
+    s >> beg >> end >> junk >> strand;
+    if (!s) err("bad GFF line: " + line);
+    beg -= 1;  // convert from 1-based to 0-based coordinate
+    long size = end - beg;
+    if (strand == '-' && opts.forwardSegNum != 1) beg = -end;
+    out.putSeg(size, seqname, beg);
+  }
+}
+
+inline void importLastTab(LineReader &in, const SegImportOptions &opts,
+			  size_t &alnNum, SegImportSink &out) {
+  StringView junk, rName, rStrand, qName, qStrand, blocks;
+  char alnNumText[maxLongTextSize];
+  StringView line;
+  while (getMarkedLine(in, line, alnNum, out)) {
+    StringView s = line;
+    s >> junk;
+    if (!s || junk[0] == '#') continue;
+    long rBeg = 0, rSpan = 0, rSeqLength = 0;
+    long qBeg = 0, qSpan = 0, qSeqLength = 0;
+    s >> rName >> rBeg >> rSpan >> rStrand >> rSeqLength
+      >> qName >> qBeg >> qSpan >> qStrand >> qSeqLength >> blocks;
+    if (!s) err("bad lastTab line: " + line);
+    if (rStrand == '-') rBeg -= rSeqLength;
+    long rEnd = rBeg + rSpan;
+    if (qStrand == '-') qBeg -= qSeqLength;
+    long qEnd = qBeg + qSpan;
+    bool isFlip = ((opts.forwardSegNum == 1 && rBeg < 0) ||
+		   (opts.forwardSegNum == 2 && qBeg < 0));
+    ++alnNum;
+    long alnPos = 0;
+    do {
+      long x, y;
+      blocks >> x;
+      if (!blocks) err("bad lastTab line: " + line);
+      char c = 0;
+      blocks >> c;
+      if (c == ':') {
+	blocks >> y;
+	if (!blocks) err("bad lastTab line: " + line);
+	rBeg += x;
+	qBeg += y;
+	alnPos += x + y;
+	blocks >> c;
+      } else {
+	long rOut = isFlip ? -(rBeg + x) : rBeg;
+	long qOut = isFlip ? -(qBeg + x) : qBeg;
+	SegRecord &r = out.newRecord(x);
+	r.add(rName, rOut);
+	r.add(qName, qOut);
+	if (opts.isAddAlignmentNum) {
+	  long alnOut = isFlip ? -(alnPos + x) : alnPos;
+	  alnPos += x;
+	  r.add(numberText(alnNumText, alnNum), alnOut);
+	}
+	out.putRecord(r);
+	rBeg += x;
+	qBeg += x;
+      }
+    } while (blocks);
+    if (rBeg != rEnd || qBeg != qEnd)  // catches translated alignments
+      err("failed on this line:\n" + line);
+  }
+}
+
+struct MafRow {
+  std::string line;
+  StringView name;
+  long start;
+  StringView seq;
+  int letterLength;
+  int lengthPerLetter;
+};
+
+inline bool isGapless(const MafRow *rows, size_t numOfRows, size_t alnPos) {
+  for (size_t i = 0; i < numOfRows; ++i) {
+    if (rows[i].seq[alnPos] == '-') return false;
+  }
+  return true;
+}
+
+// Is this column all gaps?  With -r, that happens if only rows with
+// gaps there were selected: the column is an insertion in rows that
+// were dropped.
+inline bool isAllGaps(const MafRow *rows, size_t numOfRows, size_t alnPos) {
+  for (size_t i = 0; i < numOfRows; ++i) {
+    if (rows[i].seq[alnPos] != '-') return false;
+  }
+  return true;
+}
+
+inline size_t numOfAlignedLetters(StringView seq) {
+  size_t seqlen = seq.size();
+  size_t gapCount = 0;
+  for (size_t i = 0; i < seqlen; ++i) {
+    if (seq[i] == '\\' || seq[i] == '/') return 0;
+    if (seq[i] == '-') ++gapCount;
+  }
+  return seqlen - gapCount;
+}
+
+inline void printOneMafSegment(SegImportSink &out,
+			       const SegImportOptions &opts, long length,
+			       int lenDiv, MafRow *rows, size_t numOfRows,
+			       size_t alnNum, long alnPos, bool isFlip) {
+  SegRecord &rec = out.newRecord(length / lenDiv);
+  for (size_t i = 0; i < numOfRows; ++i) {
+    const MafRow &r = rows[i];
+    long beg = isFlip ? -r.start : r.start - length * r.letterLength;
+    rec.add(r.name, beg / r.lengthPerLetter);
+  }
+  char alnNumText[maxLongTextSize];
+  if (opts.isAddAlignmentNum) {
+    long beg = isFlip ? -alnPos : alnPos - length;  // xxx ???
+    rec.add(numberText(alnNumText, alnNum), beg);
+  }
+  out.putRecord(rec);
+}
+
+inline void doOneMaf(SegImportSink &out, const SegImportOptions &opts,
+		     MafRow *rows, size_t numOfRows, size_t alnNum) {
+  size_t alnLen = 0;
+  int lenDiv = 1;
+  bool isFlip = false;
+  StringView junk, strand;
+  for (size_t i = 0; i < numOfRows; ++i) {
+    MafRow &r = rows[i];
+    StringView s(r.line);
+    long span, seqLength;
+    s >> junk >> r.name >> r.start >> span >> strand >> seqLength >> r.seq;
+    if (!s) err("bad MAF line: " + r.line);
+    size_t seqLen = r.seq.size();
+    if (i == 0) alnLen = seqLen;
+    else if (seqLen != alnLen) err("unequal alignment length:\n" + r.line);
+    if (strand == '-') {
+      r.start -= seqLength;
+      if (opts.forwardSegNum == i + 1) isFlip = true;
+    }
+    size_t letterCount = numOfAlignedLetters(r.seq);
+    r.letterLength = 1;
+    r.lengthPerLetter = 1;
+    if (letterCount < span) r.letterLength = 3;
+    if (letterCount > span) {
+      r.lengthPerLetter = 3;
+      r.start *= 3;  // protein -> DNA coordinate
+      lenDiv = 3;
+    }
+  }
+
+  // With -r, all-gap columns are skipped, so they don't break up
+  // segments, and alignment positions are in the alignment of just
+  // these rows
+  bool isSkipAllGaps = !opts.mafRowNamePrefixes.empty();
+  long len = 0;
+  long keptPos = 0;
+  for (size_t alnPos = 0; alnPos < alnLen; ++alnPos) {
+    if (isSkipAllGaps && isAllGaps(rows, numOfRows, alnPos)) continue;
+    if (isGapless(rows, numOfRows, alnPos)) {
+      ++len;
+    } else if (len) {
+      printOneMafSegment(out, opts, len, lenDiv, rows, numOfRows, alnNum,
+			 keptPos, isFlip);
+      len = 0;
+    }
+    for (size_t i = 0; i < numOfRows; ++i) {
+      MafRow &r = rows[i];
+      char symbol = r.seq[alnPos];
+      /**/ if (symbol == '/' ) r.start -= 1;
+      else if (symbol == '\\') r.start += 1;
+      else if (symbol != '-' ) r.start += r.letterLength;
+    }
+    ++keptPos;
+  }
+  if (len) {
+    printOneMafSegment(out, opts, len, lenDiv, rows, numOfRows, alnNum,
+		       keptPos, isFlip);
+  }
+}
+
+struct MafBlock {
+  std::vector<MafRow> rows;
+  size_t numOfRows;
+  size_t alnNum;
+};
+
+inline bool isSelectedMafRow(const SegImportOptions &opts, StringView line) {
+  const std::vector<const char *> &prefixes = opts.mafRowNamePrefixes;
+  if (prefixes.empty()) return true;
+  StringView s = line;
+  StringView junk, name;
+  s >> junk >> name;
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    size_t len = std::strlen(prefixes[i]);
+    if (len <= name.size() && std::memcmp(name.data(), prefixes[i], len) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Reads the "s" lines of the next alignment block, skipping rows that
+// aren't selected.  Returns false if there are no more blocks.
+inline bool readMafBlock(LineReader &in, const SegImportOptions &opts,
+			 MafBlock &block) {
+  std::vector<MafRow> &rows = block.rows;
+  size_t &numOfRows = block.numOfRows;
+  numOfRows = 0;
+  bool isBlock = false;
+  StringView line;
+  while (in.getLine(line)) {
+    const char *s = line.data();
+    if (*s == 's') {
+      isBlock = true;
+      if (!isSelectedMafRow(opts, line)) continue;
+      ++numOfRows;
+      if (rows.size() < numOfRows) rows.resize(numOfRows);
+      MafRow &r = rows[numOfRows - 1];
+      r.line.assign(line.begin(), line.end());
+    } else if (!isGraph(*s)) {
+      if (isBlock) return true;
+    }
+  }
+  return isBlock;
+}
+
+// In threaded mode, MAF blocks are read in batches.  Each thread
+// converts a contiguous slice of a batch, putting records into its
+// own buffer, and the buffers are then replayed in order, so the
+// output is the same as without threads.
+struct MafBatch {
+  std::vector<MafBlock> blocks;
+  size_t size;
+  std::vector<SegRecordBuffer> outputs;
+  std::vector<std::exception_ptr> errors;
+  std::vector<std::thread> threads;
+
+  MafBatch(unsigned numOfThreads, size_t maxSize)
+    : blocks(maxSize), size(0), outputs(numOfThreads),
+      errors(numOfThreads), threads(numOfThreads) {}
+
+  ~MafBatch() { join(); }
+
+  void join() {
+    for (size_t i = 0; i < threads.size(); ++i)
+      if (threads[i].joinable()) threads[i].join();
+  }
+
+  void doSlice(const SegImportOptions &opts, size_t t) {
+    size_t n = threads.size();
+    size_t beg = size * t / n;
+    size_t end = size * (t + 1) / n;
+    try {
+      for (size_t i = beg; i < end; ++i) {
+	MafBlock &b = blocks[i];
+	if (b.numOfRows)
+	  doOneMaf(outputs[t], opts, &b.rows[0], b.numOfRows, b.alnNum);
+      }
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  }
+
+  void start(const SegImportOptions &opts) {
+    for (size_t t = 0; t < threads.size(); ++t)
+      threads[t] = std::thread(&MafBatch::doSlice, this, std::cref(opts), t);
+  }
+
+  void finish(SegImportSink &out) {
+    join();
+    for (size_t t = 0; t < threads.size(); ++t) {
+      outputs[t].replay(out);
+      outputs[t].clear();
+      if (errors[t]) std::rethrow_exception(errors[t]);
+    }
+    size = 0;
+  }
+};
+
+inline void importMafThreaded(LineReader &in, const SegImportOptions &opts,
+			      size_t &alnNum, SegImportSink &out) {
+  const size_t blocksPerThread = 256;
+  size_t maxSize = opts.numOfThreads * blocksPerThread;
+  MafBatch x(opts.numOfThreads, maxSize);
+  MafBatch y(opts.numOfThreads, maxSize);
+  MafBatch *newBatch = &x;
+  MafBatch *oldBatch = &y;
+  while (true) {
+    MafBatch &b = *newBatch;
+    while (b.size < maxSize && readMafBlock(in, opts, b.blocks[b.size]))
+      b.blocks[b.size++].alnNum = ++alnNum;
+    if (b.size) b.start(opts);  // read the next batch while this runs
+    oldBatch->finish(out);
+    if (b.size < maxSize) break;
+    std::swap(newBatch, oldBatch);
+  }
+  newBatch->finish(out);
+}
+
+inline void importMaf(LineReader &in, const SegImportOptions &opts,
+		      size_t &alnNum, SegImportSink &out) {
+  if (opts.numOfThreads > 1) return importMafThreaded(in, opts, alnNum, out);
+  MafBlock b;
+  while (true) {
+    out.mark(in, alnNum);
+    if (!readMafBlock(in, opts, b)) break;
+    ++alnNum;
+    if (b.numOfRows)
+      doOneMaf(out, opts, &b.rows[0], b.numOfRows, alnNum);
+  }
+}
+
+inline void skipOne(StringView &s) {
+  if (!s.empty()) s.remove_prefix(1);
+}
+
+inline long lastNumber(StringView commaSeparatedNumbers) {
+  const char *b = commaSeparatedNumbers.begin();
+  const char *e = commaSeparatedNumbers.end();
+  if (!isDigit(e[-1])) --e;
+  const char *m = e;
+  while (m > b && isDigit(m[-1])) --m;
+  StringView s(m, e);
+  long n = 0;
+  s >> n;
+  return n;
+}
+
+inline void importPsl(LineReader &in, const SegImportOptions &opts,
+		      size_t &alnNum, SegImportSink &out) {
+  StringView line, junk, strand, qName, tName, blockSizes, qStarts, tStarts;
+  char alnNumText[maxLongTextSize];
+  while (getMarkedLine(in, line, alnNum, out)) {
+    StringView s = line;
+    s >> junk;
+    if (!s || !isDigit(junk)) continue;
+    long qSize, qStart, qEnd, tSize, tStart, tEnd;
+    for (int i = 0; i < 7; ++i) s >> junk;
+    s >> strand >> qName >> qSize >> qStart >> qEnd >> tName >> tSize
+      >> tStart >> tEnd >> junk >> blockSizes >> qStarts >> tStarts;
+    if (!s) err("bad PSL line: " + line);
+    char qStrand = strand[0];
+    char tStrand = strand.size() > 1 ? strand[1] : '+';
+    if (strand.size() > 2 || !isStrand(qStrand) || !isStrand(tStrand)) {
+      err("unrecognized strand:\n" + line);
+    }
+    bool isFlip = ((opts.forwardSegNum == 1 && tStrand == '-') ||
+		   (opts.forwardSegNum == 2 && qStrand == '-'));
+    long tRealEnd = (tStrand == '-') ? tSize - tStart : tEnd;
+    long qRealEnd = (qStrand == '-') ? qSize - qStart : qEnd;
+    long blockSizeLast = lastNumber(blockSizes);
+    if (blockSizeLast < 1) err("bad PSL line: " + line);
+    long tLenMul = (tRealEnd - lastNumber(tStarts)) / blockSizeLast;
+    long qLenMul = (qRealEnd - lastNumber(qStarts)) / blockSizeLast;
+    ++alnNum;
+    long alnPos = 0;
+    long len, tBeg, qBeg;
+    while(blockSizes >> len && tStarts >> tBeg && qStarts >> qBeg) {
+      if (tStrand == '-') tBeg -= tSize;
+      if (qStrand == '-') qBeg -= qSize;
+      if (alnPos) alnPos += (tBeg - tEnd) + (qBeg - qEnd);
+      tEnd = tBeg + len * tLenMul;
+      qEnd = qBeg + len * qLenMul;
+      if (isFlip) {
+	tBeg = -tEnd;
+	qBeg = -qEnd;
+      }
+      SegRecord &r = out.newRecord(len);
+      r.add(tName, tBeg);
+      r.add(qName, qBeg);
+      if (opts.isAddAlignmentNum) {
+	long alnBeg = isFlip ? -(alnPos + len) : alnPos;
+	alnPos += len;
+	r.add(numberText(alnNumText, alnNum), alnBeg);
+      }
+      out.putRecord(r);
+      skipOne(blockSizes);
+      skipOne(tStarts);
+      skipOne(qStarts);
+    }
+  }
+}
+
+struct ExonRange {
+  long beg;
+  long end;
+};
+
+inline void printPrimaryTranscript(SegImportSink &out,
+				   StringView chrom, StringView name,
+				   unsigned isRevStrands,
+				   const std::vector<ExonRange> &exons) {
+  long beg = exons.front().beg;
+  long end = exons.back().end;
+  long size = end - beg;
+  long a = (isRevStrands == 2) ? -end : beg;
+  long b = (isRevStrands == 1) ? -size : 0;
+  out.putSeg(size, chrom, a, name, b);
+}
+
+inline void printIntrons(SegImportSink &out,
+			 StringView chrom, StringView name,
+			 unsigned isRevStrands,
+			 const std::vector<ExonRange> &exons) {
+  long origin = (isRevStrands < 1) ? exons.front().beg : exons.back().end;
+  for (size_t x = 1; x < exons.size(); ++x) {
+    long i = exons[x - 1].end;
+    long j = exons[x].beg;
+    long a = (isRevStrands < 2) ? i : -j;
+    long b = (isRevStrands < 2) ? i - origin : origin - j;
+    out.putSeg(j - i, chrom, a, name, b);
+  }
+}
+
+inline void printExons(SegImportSink &out,
+		       StringView chrom, StringView name,
+		       unsigned isRevStrands,
+		       const std::vector<ExonRange> &exons,
+		       long printBeg, long printEnd) {
+  long pos = 0;
+  if (isRevStrands > 0) {
+    for (size_t i = 0; i < exons.size(); ++i) {
+      const ExonRange &r = exons[i];
+      pos -= r.end - r.beg;
+    }
+  }
+  for (size_t i = 0; i < exons.size(); ++i) {
+    const ExonRange &r = exons[i];
+    long beg = std::max(r.beg, printBeg);
+    long end = std::min(r.end, printEnd);
+    if (beg < end) {
+      long a = (isRevStrands < 2) ? beg : -end;
+      long b = (isRevStrands < 2) ? pos + beg - r.beg : r.beg - end - pos;
+      out.putSeg(end - beg, chrom, a, name, b);
+    }
+    pos += r.end - r.beg;
+  }
+}
+
+inline void getExons(SegImportSink &out,
+		     StringView chrom, StringView name, unsigned isRevStrands,
+		     const std::vector<ExonRange> &exons,
+		     long cdsBeg, long cdsEnd, const SegImportOptions &opts) {
+  if (cdsBeg >= cdsEnd && (opts.is5utr || opts.is3utr)) return;
+  bool isBegUtr = (isRevStrands < 1) ? opts.is5utr : opts.is3utr;
+  bool isEndUtr = (isRevStrands < 1) ? opts.is3utr : opts.is5utr;
+  long minBeg = exons.front().beg;
+  long maxEnd = exons.back().end;
+  if (opts.isCds) {
+    if (isBegUtr && isEndUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, minBeg, maxEnd);
+    } else if (isBegUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, minBeg, cdsEnd);
+    } else if (isEndUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, cdsBeg, maxEnd);
+    } else {
+      printExons(out, chrom, name, isRevStrands, exons, cdsBeg, cdsEnd);
+    }
+  } else {
+    if (isBegUtr && isEndUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, minBeg, cdsBeg);
+      printExons(out, chrom, name, isRevStrands, exons, cdsEnd, maxEnd);
+    } else if (isBegUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, minBeg, cdsBeg);
+    } else if (isEndUtr) {
+      printExons(out, chrom, name, isRevStrands, exons, cdsEnd, maxEnd);
+    } else {
+      printExons(out, chrom, name, isRevStrands, exons, minBeg, maxEnd);
+    }
+  }
+}
+
+inline void getGene(SegImportSink &out,
+		    StringView chrom, StringView name, bool isForwardStrand,
+		    const std::vector<ExonRange> &exons,
+		    long cdsBeg, long cdsEnd, const SegImportOptions &opts) {
+  unsigned isRevStrands =
+    isForwardStrand ? 0 : (opts.forwardSegNum == 2) ? 2 : 1;
+  if (opts.isPrimaryTranscripts)
+    printPrimaryTranscript(out, chrom, name, isRevStrands, exons);
+  else if (opts.isIntrons)
+    printIntrons(out, chrom, name, isRevStrands, exons);
+  else
+    getExons(out, chrom, name, isRevStrands, exons, cdsBeg, cdsEnd, opts);
+}
+
+inline void importBed(LineReader &in, const SegImportOptions &opts,
+		      SegImportSink &out) {
+  StringView chrom, name, junk, strand, exonLens, exonBegs;
+  std::vector<ExonRange> exons;
+  StringView line;
+  while (getMarkedLine(in, line, 0, out)) {
+    StringView s = line;
+    s >> chrom;
+    if (!s) continue;  // xxx allow for "track" lines or "#" comments?
+    long beg, end;
+    s >> beg >> end;
+    if (!s) err("bad BED line: " + line);
+    s >> name;
+    if (!s) {
+      out.putSeg(end - beg, chrom, beg);
+      continue;
+    }
+    s >> junk >> strand;
+    bool isReverseStrand = (s && strand == '-');
+    long cdsBeg = beg;
+    long cdsEnd = beg;
+    s >> cdsBeg >> cdsEnd >> junk >> junk >> exonLens >> exonBegs;
+    if (s) {
+      while (true) {
+	long elen = 0, ebeg = 0;
+	exonLens >> elen;
+	exonBegs >> ebeg;
+	if (!exonLens || !exonBegs) break;
+	ExonRange r;
+	r.beg = beg + ebeg;
+	r.end = beg + ebeg + elen;
+	exons.push_back(r);
+	skipOne(exonLens);
+	skipOne(exonBegs);
+      }
+    } else {
+      ExonRange r;
+      r.beg = beg;
+      r.end = end;
+      exons.push_back(r);
+    }
+    getGene(out, chrom, name, !isReverseStrand, exons, cdsBeg, cdsEnd, opts);
+    exons.clear();
+  }
+}
+
+inline void importGenePred(LineReader &in, const SegImportOptions &opts,
+			   SegImportSink &out) {
+  StringView name, chrom, strand, junk, exonBegs, exonEnds;
+  std::vector<ExonRange> exons;
+  StringView line;
+  while (getMarkedLine(in, line, 0, out)) {
+    StringView s = line;
+    s >> name;
+    if (!s) continue;
+    s >> chrom >> strand;
+    if (strand != '+' && strand != '-') {
+      name = chrom;
+      chrom = strand;
+      s >> strand;
+    }
+    long cdsBeg, cdsEnd;
+    s >> junk >> junk >> cdsBeg >> cdsEnd >> junk >> exonBegs >> exonEnds;
+    if (!s) err("bad genePred line: " + line);
+    while (true) {
+      ExonRange r;
+      exonBegs >> r.beg;
+      exonEnds >> r.end;
+      if (!exonBegs || !exonEnds) break;
+      exons.push_back(r);
+      skipOne(exonBegs);
+      skipOne(exonEnds);
+    }
+    getGene(out, chrom, name, strand == '+', exons, cdsBeg, cdsEnd, opts);
+    exons.clear();
+  }
+}
+
+struct Gtf {
+  StringView name;
+  StringView chrom;
+  StringView strand;
+  StringView feature;
+  long beg;
+  long end;
+
+  bool operator<(const Gtf &right) const {
+    int c = name.compare(right.name);
+    if (c) return c < 0;
+    c = chrom.compare(right.chrom);
+    if (c) return c < 0;
+    c = strand.compare(right.strand);
+    if (c) return c < 0;
+    return beg < right.beg;
+  }
+};
+
+inline StringView &readGtfTranscriptId(StringView &in, StringView &out) {
+  StringView t, v;
+  while (in >> t >> v) {
+    if (t == "transcript_id") {
+      if (v.back() == ';') v.remove_suffix(1);
+      if (!v.empty() && v.front() == '"') v.remove_prefix(1);
+      if (!v.empty() && v.back()  == '"') v.remove_suffix(1);
+      out = v;
+      break;
+    }
+  }
+  return in;
+}
+
+inline void importGtf(LineReader &in, const SegImportOptions &opts,
+		      SegImportSink &out) {
+  std::vector<std::string> lines;
+  StringView junk;
+  StringView line;
+  while (in.getLine(line)) {
+    StringView s = line;
+    s >> junk;
+    if (!s || junk[0] == '#') continue;
+    s >> junk >> junk;
+    if (!s || junk == "exon" || junk == "start_codon" || junk == "stop_codon")
+      lines.push_back(std::string(line.begin(), line.end()));
+  }
+  size_t size = lines.size();
+  std::vector<Gtf> records(size);
+  for (size_t i = 0; i < size; ++i) {
+    Gtf &r = records[i];
+    StringView s(lines[i]);
+    const char *end = std::find(s.begin(), s.end(), '#');
+    s.remove_suffix(s.end() - end);
+    s >> r.chrom >> junk >> r.feature >> r.beg >> r.end >> junk >> r.strand
+      >> junk;
+    if (!s) err("bad GTF line: " + lines[i]);
+    readGtfTranscriptId(s, r.name);
+    if (!s) err("missing transcript_id:\n" + lines[i]);
+    --r.beg;
+  }
+  sort(records.begin(), records.end());
+  std::vector<ExonRange> exons;
+  long cdsBeg = 0;
+  long cdsEnd = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const Gtf &r = records[i];
+    if (r.feature == "exon") {
+      ExonRange e;
+      e.beg = r.beg;
+      e.end = r.end;
+      exons.push_back(e);
+    } else {
+      if (cdsEnd == 0) cdsBeg = r.beg;
+      cdsEnd = r.end;
+    }
+    size_t j = i + 1;
+    if (j == size || r.name < records[j].name ||
+	r.chrom < records[j].chrom || r.strand < records[j].strand) {
+      getGene(out, r.chrom, r.name, r.strand == '+', exons, cdsBeg, cdsEnd,
+	      opts);
+      exons.clear();
+      cdsBeg = 0;
+      cdsEnd = 0;
+    }
+  }
+}
+
+// Gets the value of "key" from GFF3 attributes "key1=value1;key2=value2"
+inline StringView gff3Attribute(StringView attributes, const char *key) {
+  size_t keySize = std::strlen(key);
+  const char *b = attributes.begin();
+  const char *e = attributes.end();
+  while (b < e) {
+    const char *m = std::find(b, e, ';');
+    while (b < m && *b == ' ') ++b;
+    if (m > b + keySize && b[keySize] == '=' &&
+	std::memcmp(b, key, keySize) == 0)
+      return StringView(b + keySize + 1, m);
+    b = m + 1;
+  }
+  return StringView();
+}
+
+// A GFF3 feature with exon or CDS children, e.g. an mRNA
+struct Gff3Transcript {
+  size_t serialNum;  // for writing transcripts in input order
+  std::string chrom;
+  std::string name;
+  char strand;
+  long end;
+  std::vector<ExonRange> exons;
+  std::vector<ExonRange> cdsRanges;
+};
+
+typedef std::unordered_map<std::string, Gff3Transcript> Gff3Transcripts;
+
+inline bool isLessBeg(const ExonRange &x, const ExonRange &y) {
+  return x.beg < y.beg;
+}
+
+inline bool isLessSerialNum(Gff3Transcripts::iterator x,
+			    Gff3Transcripts::iterator y) {
+  return x->second.serialNum < y->second.serialNum;
+}
+
+inline void getGff3Transcript(SegImportSink &out, Gff3Transcript &t,
+			      const SegImportOptions &opts) {
+  // if there are no exons, e.g. a bacterial gene with just a CDS, use
+  // the CDS as exons
+  std::vector<ExonRange> &exons = t.exons.empty() ? t.cdsRanges : t.exons;
+  if (exons.empty()) return;
+  long cdsBeg = 0;
+  long cdsEnd = 0;
+  for (size_t i = 0; i < t.cdsRanges.size(); ++i) {
+    const ExonRange &r = t.cdsRanges[i];
+    if (i == 0 || r.beg < cdsBeg) cdsBeg = r.beg;
+    if (i == 0 || r.end > cdsEnd) cdsEnd = r.end;
+  }
+  sort(exons.begin(), exons.end(), isLessBeg);
+  getGene(out, StringView(t.chrom), StringView(t.name), t.strand == '+',
+	  exons, cdsBeg, cdsEnd, opts);
+}
+
+// Writes the transcripts that end at or before "pos", in input order,
+// and forgets them.  Returns the minimum end of the remaining ones.
+inline long flushGff3Transcripts(SegImportSink &out, Gff3Transcripts &pending,
+				 long pos, const SegImportOptions &opts) {
+  std::vector<Gff3Transcripts::iterator> done;
+  long minEnd = LONG_MAX;
+  for (Gff3Transcripts::iterator i = pending.begin(); i != pending.end(); ++i) {
+    if (i->second.end <= pos) done.push_back(i);
+    else minEnd = std::min(minEnd, i->second.end);
+  }
+  sort(done.begin(), done.end(), isLessSerialNum);
+  for (size_t i = 0; i < done.size(); ++i) {
+    getGff3Transcript(out, done[i]->second, opts);
+    pending.erase(done[i]);
+  }
+  return minEnd;
+}
+
+inline Gff3Transcript &gff3Transcript(Gff3Transcripts &pending,
+				      size_t &serialNum, StringView id,
+				      StringView chrom, StringView strand) {
+  std::string key(id.begin(), id.end());
+  std::pair<Gff3Transcripts::iterator, bool> p =
+    pending.insert(std::make_pair(key, Gff3Transcript()));
+  Gff3Transcript &t = p.first->second;
+  if (p.second) {
+    t.serialNum = serialNum++;
+    t.chrom.assign(chrom.begin(), chrom.end());
+    t.name = key;
+    t.strand = strand[0];
+    t.end = 0;
+  }
+  return t;
+}
+
+// Exon and CDS lines are linked to their transcripts by the Parent
+// attribute.  A transcript is written when it's certainly complete:
+// at a "###" line, a change of sequence, or a top-level feature (one
+// without a Parent) that starts at or after the transcript's end.  So
+// the features should be sorted by top-level feature, as usual, and
+// then only overlapping transcripts are held in memory.
+inline void importGff3(LineReader &in, const SegImportOptions &opts,
+		       SegImportSink &out) {
+  Gff3Transcripts pending;
+  size_t serialNum = 0;
+  long minPendingEnd = LONG_MAX;
+  std::string chrom;
+  StringView f[9];
+  StringView line;
+  while (in.getLine(line)) {
+    StringView s = line;
+    if (s.empty()) continue;
+    if (s[0] == '#') {
+      if (s == "###")
+	minPendingEnd = flushGff3Transcripts(out, pending, LONG_MAX, opts);
+      continue;
+    }
+    for (int i = 0; i < 9; ++i) getWordWithSpaces(s, f[i]);
+    StringView b = f[3];
+    StringView e = f[4];
+    long beg, end;
+    if (!s || !(b >> beg) || !(e >> end)) err("bad GFF3 line: " + line);
+    beg -= 1;  // convert from 1-based to 0-based coordinate
+    if (f[0] != StringView(chrom)) {
+      minPendingEnd = flushGff3Transcripts(out, pending, LONG_MAX, opts);
+      chrom.assign(f[0].begin(), f[0].end());
+    }
+    StringView parents = gff3Attribute(f[8], "Parent");
+    bool isExon = (f[2] == "exon");
+    if (isExon || f[2] == "CDS") {
+      ExonRange r;
+      r.beg = beg;
+      r.end = end;
+      while (parents) {  // there may be several, separated by commas
+	const char *m = std::find(parents.begin(), parents.end(), ',');
+	StringView p(parents.begin(), m);
+	parents = (m < parents.end()) ? StringView(m + 1, parents.end())
+	  : StringView();
+	Gff3Transcript &t = gff3Transcript(pending, serialNum, p, f[0], f[6]);
+	(isExon ? t.exons : t.cdsRanges).push_back(r);
+	t.end = std::max(t.end, end);
+	minPendingEnd = std::min(minPendingEnd, t.end);
+      }
+      continue;
+    }
+    if (!parents && beg >= minPendingEnd)
+      minPendingEnd = flushGff3Transcripts(out, pending, beg, opts);
+    StringView id = gff3Attribute(f[8], "ID");
+    if (!id) continue;
+    Gff3Transcript &t = gff3Transcript(pending, serialNum, id, f[0], f[6]);
+    StringView transcriptId = gff3Attribute(f[8], "transcript_id");
+    if (transcriptId) t.name.assign(transcriptId.begin(), transcriptId.end());
+    t.strand = f[6][0];
+    t.end = std::max(t.end, end);
+    minPendingEnd = std::min(minPendingEnd, t.end);
+  }
+  flushGff3Transcripts(out, pending, LONG_MAX, opts);
+}
+
+struct SegmentPair {
+  long rStart;
+  long qStart;
+  long length;
+};
+
+inline void addBlock(std::vector<SegmentPair> &blocks,
+		     long rpos, long qpos, long length) {
+  SegmentPair x;
+  x.rStart = rpos;
+  x.qStart = qpos;
+  x.length = length;
+  blocks.push_back(x);
+}
+
+inline void parseCigar(std::vector<SegmentPair> &blocks, StringView &cigar,
+		       long &rpos, long &qpos) {
+  long length = 0;
+  long size;
+  char type;
+  while (cigar >> size >> type) {
+    switch (type) {
+    case 'M': case '=': case 'X':
+      length += size;
+      break;
+    case 'D': case 'N':
+      if (length) addBlock(blocks, rpos, qpos, length);
+      rpos += length + size;
+      qpos += length;
+      length = 0;
+      break;
+    case 'I': case 'S': case 'H':
+      if (length) addBlock(blocks, rpos, qpos, length);
+      rpos += length;
+      qpos += length + size;
+      length = 0;
+      break;
+    default:
+      break;  // xxx ???
+    }
+  }
+  if (length) addBlock(blocks, rpos, qpos, length);
+  qpos += length;
+  rpos += length;
+}
+
+inline void importSam(LineReader &in, const SegImportOptions &opts,
+		      SegImportSink &out) {
+  StringView qname, rname, junk, cigar;
+  std::vector<SegmentPair> blocks;
+  StringView line;
+  std::string qnameText;
+  while (getMarkedLine(in, line, 0, out)) {
+    StringView s = line;
+    if (s[0] == '@') continue;
+    s >> qname;
+    if (!s) continue;
+    unsigned flag = 0, mapq = 0;
+    long rpos;
+    s >> flag >> rname >> rpos >> mapq >> cigar;
+    if (!s) err("bad SAM line: " + line);
+    if ((flag & 4) || (flag & opts.samSkipFlags)) continue;
+    if (mapq < opts.samMinMapq) continue;
+    bool isReverseStrand = (flag & 16);
+    const char *suffix = (flag & 64) ? "/1" : (flag & 128) ? "/2" : "";
+    qnameText.assign(qname.begin(), qname.end());
+    qnameText += suffix;
+    rpos -= 1;
+    long qpos = 0;
+    parseCigar(blocks, cigar, rpos, qpos);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const SegmentPair &x = blocks[i];
+      long qBeg = x.qStart;
+      long rBeg = x.rStart;
+      if (isReverseStrand) {
+	qBeg -= qpos;
+	if (opts.forwardSegNum == 2) {
+	  qBeg = -(qBeg + x.length);
+	  rBeg = -(rBeg + x.length);
+	}
+      }
+      out.putSeg(x.length, rname, rBeg, StringView(qnameText), qBeg);
+    }
+    blocks.clear();
+  }
+}
+
+inline void importRmsk(LineReader &in, const SegImportOptions &opts,
+		       SegImportSink &out) {
+  std::string rText;
+  StringView line, junk, qName, rName, rType, rType2;
+  while (getMarkedLine(in, line, 0, out)) {
+    StringView s = line;
+    long beg, end;
+    char strand = 0;
+    s >> junk >> junk >> junk >> junk >> qName >> beg >> end
+      >> junk >> strand >> rName >> rType;
+    if (s) {
+      --beg;
+    } else {
+      StringView t = line;
+      t >> junk >> junk >> junk >> junk >> junk >> qName >> beg >> end
+	>> junk >> strand >> rName >> rType >> rType2;
+      if (!t) continue;
+    }
+    long len = end - beg;
+    long x = (strand == '+' || opts.forwardSegNum != 2) ? beg : -end;
+    long y = (strand == '+' || opts.forwardSegNum == 2) ? 0 : -len;
+    rText.assign(rName.begin(), rName.end());
+    rText += '#';
+    rText.append(rType.begin(), rType.end());
+    if (!s && rType2 != rType) {
+      rText += '/';
+      rText.append(rType2.begin(), rType2.end());
+    }
+    out.putSeg(len, qName, x, StringView(rText), y);
+  }
+}
+
+// Reads data in the named format, and puts it as SEG records.
+// alnNum is the number of alignments read so far, and gets updated.
+inline void importSegs(LineReader &in, const char *formatName,
+		       const SegImportOptions &opts, size_t &alnNum,
+		       SegImportSink &out) {
+  std::string n = formatName;
+  makeLowercase(n);
+  if      (n == "bed") importBed(in, opts, out);
+  else if (n == "chain") importChain(in, opts, out);
+  else if (n == "genepred") importGenePred(in, opts, out);
+  else if (n == "gff") importGff(in, opts, out);
+  else if (n == "gff3") importGff3(in, opts, out);
+  else if (n == "gtf") importGtf(in, opts, out);
+  else if (n == "lasttab") importLastTab(in, opts, alnNum, out);
+  else if (n == "maf") importMaf(in, opts, alnNum, out);
+  else if (n == "psl") importPsl(in, opts, alnNum, out);
+  else if (n == "rmsk") importRmsk(in, opts, out);
+  else if (n == "sam") importSam(in, opts, out);
+  else err("unknown format: " + std::string(formatName));
+}
+
+}
+
+#endif
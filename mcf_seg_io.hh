@@ -0,0 +1,541 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Input and output functions shared by the seg-suite programs.
+
+#ifndef MCF_SEG_IO_HH
+#define MCF_SEG_IO_HH
+
+#include "mcf_string_view.hh"
+
+#include <unistd.h>  // truncate
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace mcf {
+
+inline void err(const std::string &s) {
+  throw std::runtime_error(s);
+}
+
+inline std::istream &openIn(const char *fileName, std::ifstream &ifs) {
+  if (isChar(fileName, '-')) return std::cin;
+  ifs.open(fileName);
+  if (!ifs) err("can't open file: " + std::string(fileName));
+  return ifs;
+}
+
+// This writes a "long" integer into a char buffer ending at "end".
+// It writes backwards from the end, because that's easier & faster.
+inline char *writeLong(char *end, long x) {
+  unsigned long y = x;
+  if (x < 0) y = -y;
+  do {
+    *--end = '0' + y % 10;
+    y /= 10;
+  } while (y);
+  if (x < 0) *--end = '-';
+  return end;
+}
+
+// Enough space for writeLong, plus a separator
+const size_t maxLongTextSize = 21;
+
+// Reads a number of bytes, with an optional suffix K, M, or G
+inline bool readByteSize(const char *s, size_t &out) {
+  unsigned long z;
+  const char *e = s + std::strlen(s);
+  const char *m = isDigit(*s) ? readDigits(s, e, ULONG_MAX, z) : 0;
+  if (!m) return false;
+  if (m < e) {
+    int shift = (*m == 'K') ? 10 : (*m == 'M') ? 20 : (*m == 'G') ? 30 : 0;
+    if (!shift || m + 1 < e || z > (ULONG_MAX >> shift)) return false;
+    z <<= shift;
+  }
+  out = z;
+  return out > 0;
+}
+
+// A bounded first-in first-out queue, for handing things between
+// threads.  Closing it wakes everyone up: after that, put fails, and
+// get fails once the queue is empty.
+template<typename T> class Pipe {
+public:
+  explicit Pipe(size_t maxSize) : maxSize(maxSize), isClosed(false) {}
+
+  bool put(T &x) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (items.size() >= maxSize && !isClosed) changed.wait(lock);
+    if (isClosed) return false;
+    items.push_back(std::move(x));
+    changed.notify_all();
+    return true;
+  }
+
+  bool get(T &x) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (items.empty() && !isClosed) changed.wait(lock);
+    if (items.empty()) return false;
+    x = std::move(items.front());
+    items.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  bool tryGet(T &x) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (items.empty()) return false;
+    x = std::move(items.front());
+    items.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    isClosed = true;
+    changed.notify_all();
+  }
+
+private:
+  size_t maxSize;
+  bool isClosed;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable changed;
+};
+
+const size_t pipeDepth = 4;
+
+// Somewhere to write SEG text, one whole line at a time
+class SegTextOutput {
+public:
+  virtual ~SegTextOutput() {}
+
+  virtual void write(const char *beg, size_t size) = 0;
+};
+
+// Output text is gathered in large chunks, which are written either
+// directly, or (after startThread) by a background thread.  Anything
+// not yet written is written when this is destroyed.
+class SegOutput : public SegTextOutput {
+public:
+  explicit SegOutput(std::ostream &out)
+    : out(out), fullChunks(pipeDepth), emptyChunks(pipeDepth + 2) {}
+
+  ~SegOutput() { finish(); }
+
+  void startThread() {
+    thread = std::thread(&SegOutput::writeBehind, this);
+  }
+
+  void write(const char *beg, size_t size) {
+    text.insert(text.end(), beg, beg + size);
+    if (text.size() >= chunkSize) sendText();
+  }
+
+  // Writes everything, and stops the background thread (if any)
+  void finish() {
+    if (thread.joinable()) {
+      fullChunks.close();
+      thread.join();
+    }
+    sendText();
+  }
+
+private:
+  static const size_t chunkSize = 1 << 20;
+  std::ostream &out;
+  std::vector<char> text;
+  Pipe<std::vector<char> > fullChunks;
+  Pipe<std::vector<char> > emptyChunks;
+  std::thread thread;
+
+  void sendText() {
+    if (thread.joinable()) {
+      fullChunks.put(text);
+      if (!emptyChunks.tryGet(text)) text = std::vector<char>();
+      text.clear();
+    } else {
+      out.write(text.data(), text.size());
+      text.clear();
+    }
+  }
+
+  void writeBehind() {
+    std::vector<char> chunk;
+    while (fullChunks.get(chunk)) {
+      out.write(chunk.data(), chunk.size());
+      emptyChunks.put(chunk);  // recycle it: never waits
+    }
+  }
+};
+
+// Reads lines in large chunks, from a C file or a C++ stream buffer,
+// finding the line ends with memchr.  This avoids the per-character
+// overhead of getline, even for pipes.  Lines can be any length: the
+// buffer grows if needed.
+class LineReader {
+public:
+  static const size_t defaultChunkSize = 1 << 22;
+
+  explicit LineReader(std::FILE *file, size_t chunkSize = defaultChunkSize)
+    : file(file), stream(0), chunkSize(chunkSize), beg(0), end(0),
+      pos(0) {}
+
+  explicit LineReader(std::istream &in, size_t chunkSize = defaultChunkSize)
+    : file(0), stream(in.rdbuf()), chunkSize(chunkSize), beg(0), end(0),
+      pos(0) {}
+
+  // Gets the next line, without its newline, but followed by a NUL
+  // char.  It stays valid until the next call.
+  bool getLine(StringView &line) {
+    if (!getRawLine(line)) return false;
+    char *e = buf.data() + (line.end() - buf.data());
+    if (line.end() > line.begin() && e[-1] == '\n') --e;
+    *e = 0;
+    line = StringView(line.begin(), e);
+    return true;
+  }
+
+  // Gets the next line, including its newline (if any).  It stays
+  // valid until the next call.
+  bool getRawLine(StringView &line) {
+    while (true) {
+      const char *b = buf.data() + beg;
+      const char *e = buf.data() + end;
+      const char *m = static_cast<const char *>(std::memchr(b, '\n', e - b));
+      if (m) {
+	line = StringView(b, m + 1);
+	beg = m + 1 - buf.data();
+	pos += line.size();
+	return true;
+      }
+      std::memmove(buf.data(), b, e - b);
+      end -= beg;
+      beg = 0;
+      if (buf.size() < chunkSize + 1) buf.resize(chunkSize + 1);
+      if (end + 1 == buf.size()) buf.resize(end * 2 + 1);
+      size_t n = read(buf.data() + end, buf.size() - 1 - end);
+      if (n == 0) {
+	if (end == 0) return false;
+	line = StringView(buf.data(), buf.data() + end);
+	pos += end;
+	end = 0;
+	return true;
+      }
+      end += n;
+    }
+  }
+
+  // The byte offset of the next line
+  size_t offset() const { return pos; }
+
+  // Goes to byte offset "pos" in the input.  If that's ahead, in data
+  // already read, it just skips there.
+  void seek(size_t pos) {
+    if (pos >= this->pos && pos - this->pos <= end - beg) {
+      beg += pos - this->pos;
+      this->pos = pos;
+      return;
+    }
+    bool isOk = file ? std::fseek(file, pos, SEEK_SET) == 0
+      : stream->pubseekpos(pos, std::ios::in) == std::streampos(pos);
+    if (!isOk) err("can't seek in a file");
+    beg = end = 0;
+    this->pos = pos;
+  }
+
+private:
+  std::FILE *file;
+  std::streambuf *stream;
+  size_t chunkSize;
+  std::vector<char> buf;  // has room for a NUL after the data
+  size_t beg;
+  size_t end;
+  size_t pos;
+
+  size_t read(char *b, size_t size) {
+    if (stream) return stream->sgetn(b, size);
+    size_t n = std::fread(b, 1, size, file);
+    if (n == 0 && std::ferror(file)) err("can't read a file");
+    return n;
+  }
+};
+
+// SEG text, kept in a temporary file until it's copied elsewhere
+class SegTempOutput : public SegTextOutput {
+public:
+  SegTempOutput() : file(std::tmpfile()) {
+    if (!file) err("can't make a temporary file");
+  }
+
+  ~SegTempOutput() { std::fclose(file); }
+
+  void write(const char *beg, size_t size) {
+    if (std::fwrite(beg, 1, size, file) != size)
+      err("can't write a temporary file");
+  }
+
+  // Gets ready to read the text from the start
+  std::FILE *rewound() {
+    if (std::fflush(file) != 0) err("can't write a temporary file");
+    std::rewind(file);
+    return file;
+  }
+
+  // Copies all the text, one line at a time
+  void copyTo(SegTextOutput &out) {
+    LineReader reader(rewound());
+    StringView line;
+    while (reader.getRawLine(line)) out.write(line.data(), line.size());
+  }
+
+private:
+  std::FILE *file;
+};
+
+const char segCheckpointTag[] = "#seg-checkpoint";
+
+const unsigned defaultCheckpointInterval = 60;  // seconds
+
+// Writes SEG text to a file, and now and then records a checkpoint in
+// FILE.ckpt: how much text has been written so far, and how far the
+// input has been read (numbers given by the program).  An interrupted
+// run can be resumed from its last checkpoint.  The checkpoint also
+// has a key (such as the options and input names), so that it isn't
+// used by a different run.
+class SegCheckpointOutput : public SegTextOutput {
+public:
+  // If isResume, the file is cut back to the last checkpoint, and
+  // "position" gets the input position recorded then.  Else, the file
+  // is started afresh, and "position" is made empty.
+  SegCheckpointOutput(const std::string &fileName, const std::string &key,
+		      double interval, bool isResume,
+		      std::vector<size_t> &position)
+    : fileName(fileName), ckptName(fileName + ".ckpt"), key(key),
+      interval(interval), size(0), out(file) {
+    position.clear();
+    if (isResume) {
+      readCheckpoint(position);
+      std::ifstream f(fileName.c_str(), std::ios::binary | std::ios::ate);
+      if (!f || static_cast<size_t>(f.tellg()) < size)
+	err("file is shorter than its checkpoint: " + fileName);
+      if (truncate(fileName.c_str(), size) != 0)
+	err("can't truncate file: " + fileName);
+      file.open(fileName.c_str(), std::ios::binary | std::ios::app);
+    } else {
+      file.open(fileName.c_str(), std::ios::binary);
+    }
+    if (!file) err("can't open file: " + fileName);
+    lastTime = Clock::now();
+  }
+
+  void write(const char *beg, size_t size) {
+    out.write(beg, size);
+    this->size += size;
+  }
+
+  // Has the interval passed since the last checkpoint?
+  bool isDue() const {
+    return Clock::now() - lastTime >= std::chrono::duration<double>(interval);
+  }
+
+  // Writes all the text so far, then records it with the input
+  // position.  The checkpoint file is replaced atomically.
+  void checkpoint(const std::vector<size_t> &position) {
+    out.finish();
+    if (!file.flush()) err("can't write file: " + fileName);
+    std::string tmpName = ckptName + ".tmp";
+    std::ofstream c(tmpName.c_str());
+    c << segCheckpointTag << '\t' << key << '\n' << size;
+    for (size_t i = 0; i < position.size(); ++i) c << '\t' << position[i];
+    c << '\n';
+    c.close();
+    if (!c) err("can't write file: " + tmpName);
+    if (std::rename(tmpName.c_str(), ckptName.c_str()))
+      err("can't rename to: " + ckptName);
+    lastTime = Clock::now();
+  }
+
+  void finish() {
+    out.finish();
+    file.close();
+    if (!file) err("can't write file: " + fileName);
+  }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::string fileName;
+  std::string ckptName;
+  std::string key;
+  double interval;  // seconds
+  size_t size;
+  std::ofstream file;
+  SegOutput out;
+  Clock::time_point lastTime;
+
+  void readCheckpoint(std::vector<size_t> &position) {
+    std::ifstream in(ckptName.c_str());
+    if (!in) err("can't open file: " + ckptName);
+    std::string line;
+    if (!getline(in, line)) err("bad file: " + ckptName);
+    if (line != segCheckpointTag + ('\t' + key))
+      err("the checkpoint is for a different run: " + ckptName);
+    if (!(in >> size)) err("bad file: " + ckptName);
+    size_t x;
+    while (in >> x) position.push_back(x);
+    if (!in.eof()) err("bad file: " + ckptName);
+  }
+};
+
+// A hash of a string, which is the same in every run of a program
+inline size_t stableHash(StringView s) {
+  unsigned long long h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = s[i];
+    h = (h ^ c) * 0x100000001B3ULL;  // FNV-1a
+  }
+  return h;
+}
+
+// The first sequence name in a line of SEG text
+inline StringView firstSeqName(const char *beg, const char *end) {
+  while (beg < end && isGraph(*beg)) ++beg;
+  while (beg < end && !isGraph(*beg)) ++beg;
+  const char *e = beg;
+  while (e < end && isGraph(*e)) ++e;
+  return StringView(beg, e);
+}
+
+// Writes SEG lines into several files, chosen by the first sequence
+// name in each line.  If numOfShards is 0, there's one file per name,
+// called PREFIXname.seg, else there are numOfShards files, called
+// PREFIX0.seg, PREFIX1.seg, etc., chosen by hashing the name.  Either
+// way, all the lines for one name go into the same file, in order.
+// With one file per name, only the current file is open: the output is
+// usually sorted by name, and if a name comes back, its file is
+// reopened for appending.
+class SegShardOutput : public SegTextOutput {
+public:
+  SegShardOutput(const std::string &prefix, size_t numOfShards)
+    : prefix(prefix), numOfShards(numOfShards), lastShard(0) {
+    for (size_t i = 0; i < numOfShards; ++i) {
+      char buf[maxLongTextSize];
+      char *e = buf + maxLongTextSize;
+      addShard(std::string(writeLong(e, i), e));
+    }
+  }
+
+  ~SegShardOutput() {
+    for (size_t i = 0; i < shards.size(); ++i) shards[i]->out.finish();
+  }
+
+  void write(const char *beg, size_t size) {
+    StringView name = firstSeqName(beg, beg + size);
+    if (shards.empty() || name != StringView(lastName)) {
+      lastName.assign(name.begin(), name.end());
+      lastShard = shardIndex(name);
+    }
+    shards[lastShard]->out.write(beg, size);
+  }
+
+  // Writes everything, and checks that it worked
+  void finish() {
+    for (size_t i = 0; i < shards.size(); ++i) closeShard(*shards[i]);
+  }
+
+private:
+  struct Shard {
+    std::string fileName;
+    std::ofstream file;
+    SegOutput out;
+    Shard(const std::string &f, std::ios::openmode mode)
+      : fileName(f), file(f.c_str(), mode), out(file) {}
+  };
+
+  std::string prefix;
+  size_t numOfShards;
+  std::vector<std::unique_ptr<Shard> > shards;
+  std::unordered_set<std::string> names;  // names that have had a file
+  std::string lastName;
+  size_t lastShard;
+
+  void addShard(const std::string &key,
+		std::ios::openmode mode = std::ios::out) {
+    Shard *x = new Shard(prefix + key + ".seg", mode);
+    shards.push_back(std::unique_ptr<Shard>(x));
+    if (!x->file) err("can't open file: " + x->fileName);
+  }
+
+  static void closeShard(Shard &x) {
+    x.out.finish();
+    x.file.close();
+    if (!x.file) err("can't write file: " + x.fileName);
+  }
+
+  size_t shardIndex(StringView name) {
+    if (numOfShards) return stableHash(name) % numOfShards;
+    bool isNew = names.insert(lastName).second;
+    if (isNew &&
+	(name.empty() || std::find(name.begin(), name.end(), '/') != name.end()))
+      err("can't make a file name from: " + lastName);
+    if (!shards.empty()) {
+      closeShard(*shards[0]);
+      shards.clear();
+    }
+    addShard(lastName, isNew ? std::ios::out : std::ios::app);
+    return 0;
+  }
+};
+
+struct SegOutputOptions {
+  const char *shardPrefix;  // if null, write to standard output
+  size_t numOfShards;       // see SegShardOutput
+};
+
+// Where the programs write their SEG text: either standard output, or
+// shard files
+class SegDestination {
+public:
+  SegDestination(const SegOutputOptions &opts, bool isThreaded)
+    : standardOutput(std::cout) {
+    if (opts.shardPrefix)
+      shards.reset(new SegShardOutput(opts.shardPrefix, opts.numOfShards));
+    else if (isThreaded)
+      standardOutput.startThread();
+  }
+
+  SegTextOutput &get() {
+    if (shards) return *shards;
+    return standardOutput;
+  }
+
+  void finish() {
+    if (shards) shards->finish();
+    standardOutput.finish();
+  }
+
+private:
+  SegOutput standardOutput;
+  std::unique_ptr<SegShardOutput> shards;
+};
+
+}
+
+#endif
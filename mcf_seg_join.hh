@@ -0,0 +1,1295 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Reading sorted SEG data, and joining it.  This is what seg-join
+// does, but it can also be used directly from other programs: the
+// records can come from any SegSource, and the results go to any
+// SegJoinSink.
+
+#ifndef MCF_SEG_JOIN_HH
+#define MCF_SEG_JOIN_HH
+
+#include "mcf_seg_io.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <stddef.h>  // size_t
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mcf {
+
+struct Fraction {
+  double numer;
+  double denom;
+};
+
+struct SegJoinOptions {
+  bool isComplete1;
+  bool isComplete2;
+  int overlappingFileNumber;
+  int unjoinableFileNumber;
+  bool isJoinOnAllSegments;
+  Fraction minOverlap;
+  bool isCoverage;  // give the covered length of overlapping records
+  size_t maxMemory;  // for kept records: if more, spill them (0 = no limit)
+};
+
+inline bool isSegSpace(char c) {
+  return c > 0 && c <= ' ';  // faster than std::isspace
+}
+
+inline const char *readSegLong(const char *c, const char *e, long &x) {
+  if (!c) return 0;
+  while (isSegSpace(*c)) ++c;
+  return readLong(c, e, x);
+}
+
+inline const char *readSegWord(const char *c, const char *e,
+			       const char *&s) {
+  if (!c) return 0;
+  while (isSegSpace(*c)) ++c;
+  const char *w = graphEnd(c, e);
+  if (w == c) return 0;
+  s = c;
+  return w;
+}
+
+inline bool isDataLine(const char *s) {
+  for ( ; ; ++s) {
+    if (*s == '#') return false;
+    if (isGraph(*s)) return true;
+    if (*s == 0) return false;
+  }
+}
+
+inline bool getDataLine(LineReader &in, StringView &line) {
+  while (in.getLine(line))
+    if (isDataLine(line.data()))
+      return true;
+  return false;
+}
+
+typedef unsigned long long Hash;
+
+inline Hash hashMix(Hash h, Hash x) {
+  return (h ^ x) * 0x100000001B3ULL;  // FNV-1a style
+}
+
+inline Hash nameHash(const char *beg, const char *end) {
+  Hash h = 0xCBF29CE484222325ULL;
+  for ( ; beg < end; ++beg) h = hashMix(h, static_cast<unsigned char>(*beg));
+  return h;
+}
+
+// The names in one reader's previous line, which usually recur, so
+// their hashes needn't be calculated again
+struct RecentNames {
+  std::vector<std::string> names;
+  std::vector<Hash> hashes;
+};
+
+inline Hash nameHash(RecentNames &recent, size_t part,
+		     const char *beg, const char *end) {
+  std::vector<std::string> &names = recent.names;
+  size_t len = end - beg;
+  if (part < names.size()) {
+    const std::string &n = names[part];
+    if (n.size() == len && std::memcmp(n.data(), beg, len) == 0)
+      return recent.hashes[part];
+  } else {
+    names.resize(part + 1);
+    recent.hashes.resize(part + 1);
+  }
+  names[part].assign(beg, end);
+  return recent.hashes[part] = nameHash(beg, end);
+}
+
+// The sequence names of a segment-tuple are stored in its own text,
+// one after another, so nothing outlives the record
+struct SegPart {
+  unsigned seqNameBeg;  // in Seg::names
+  unsigned seqNameLen;
+  Hash seqNameHash;
+  long start;
+};
+
+struct Seg {
+  long part0end;
+  unsigned long long signature;  // see segSignature
+  std::vector<SegPart> parts;
+  std::string names;
+};
+
+inline long segBeg(const Seg &s, size_t i) {
+  return s.parts[i].start;
+}
+
+inline long beg0(const Seg &s) {
+  return s.parts[0].start;
+}
+
+inline long end0(const Seg &s) {
+  return s.part0end;
+}
+
+inline StringView seqName(const Seg &s, size_t part) {
+  const SegPart &p = s.parts[part];
+  const char *b = s.names.data() + p.seqNameBeg;
+  return StringView(b, b + p.seqNameLen);
+}
+
+// Appends a part, whose name is [beg, end) with hash h
+inline void addSegPart(Seg &s, const char *beg, const char *end, Hash h,
+		       long start) {
+  size_t b = s.names.size();
+  size_t len = end - beg;
+  if (b + len > UINT_MAX) err("sequence names too long");
+  SegPart p = {static_cast<unsigned>(b), static_cast<unsigned>(len), h,
+	       start};
+  s.names.append(beg, end);
+  s.parts.push_back(p);
+}
+
+inline void moveSeg(Seg &from, Seg &to) {
+  to.part0end = from.part0end;
+  to.signature = from.signature;
+  swap(from.parts, to.parts);
+  swap(from.names, to.names);
+}
+
+inline int nameCmp(const Seg &x, const Seg &y, size_t part) {
+  return seqName(x, part).compare(seqName(y, part));
+}
+
+inline char *writeName(char *end, const Seg &s, size_t part) {
+  StringView n = seqName(s, part);
+  end -= n.size();
+  std::memcpy(end, n.data(), n.size());
+  return end;
+}
+
+// Enough space to write s as a SEG line
+inline size_t maxTextSize(const Seg &s) {
+  return maxLongTextSize + s.names.size() +
+    s.parts.size() * (1 + maxLongTextSize);
+}
+
+// A hash of a segment-tuple's non-first sequence names, and their
+// start coordinates relative to the first start.  If isOverlappable
+// is true for two segment-tuples, their signatures are equal.
+inline Hash segSignature(const Seg &s) {
+  Hash h = hashMix(0xCBF29CE484222325ULL, s.parts.size());
+  unsigned long b = beg0(s);
+  for (size_t i = 1; i < s.parts.size(); ++i) {
+    const SegPart &p = s.parts[i];
+    h = hashMix(h, p.seqNameHash);
+    unsigned long start = p.start;
+    h = hashMix(h, start - b);
+  }
+  return h;
+}
+
+// Sets the rest of s, after its parts have been filled in
+inline void setSegLength(Seg &s, long length) {
+  s.part0end = beg0(s) + length;
+  s.signature = segSignature(s);
+}
+
+// Sets s from a data line of SEG text, which must be followed by a NUL
+inline void parseSeg(StringView line, RecentNames &recent, Seg &s) {
+  s.parts.clear();
+  const char *b = line.data();
+  const char *e = b + line.size();
+  s.names.clear();
+  long length = 0;
+  const char *c = readSegLong(b, e, length);
+  while (true) {
+    const char *n;
+    c = readSegWord(c, e, n);
+    if (!c) break;
+    const char *nameEnd = c;
+    long start;
+    c = readSegLong(c, e, start);
+    if (!c) err("bad SEG line: " + line);
+    Hash h = nameHash(recent, s.parts.size(), n, nameEnd);
+    addSegPart(s, n, nameEnd, h, start);
+  }
+  if (s.parts.empty()) err("bad SEG line: " + line);
+  setSegLength(s, length);
+}
+
+inline bool readSeg(LineReader &in, RecentNames &recent, Seg &s) {
+  s.parts.clear();
+  StringView line;
+  if (!getDataLine(in, line)) return false;
+  parseSeg(line, recent, s);
+  return true;
+}
+
+// Somewhere to get segment-tuples from
+class SegSource {
+public:
+  virtual ~SegSource() {}
+
+  // Gets the next one, or returns false if there are no more
+  virtual bool read(Seg &s) = 0;
+};
+
+// Gets segment-tuples by parsing SEG text
+class SegStreamSource : public SegSource {
+public:
+  explicit SegStreamSource(std::istream &in) : in(in) {}
+
+  bool read(Seg &s) { return readSeg(in, recentNames, s); }
+
+private:
+  LineReader in;
+  RecentNames recentNames;
+};
+
+// Gets segment-tuples from a vector
+class SegVectorSource : public SegSource {
+public:
+  explicit SegVectorSource(const std::vector<Seg> &segs)
+    : segs(segs), pos(0) {}
+
+  bool read(Seg &s) {
+    if (pos == segs.size()) return false;
+    s = segs[pos++];
+    return true;
+  }
+
+private:
+  const std::vector<Seg> &segs;
+  size_t pos;
+};
+
+// Gets segment-tuples from another source, which is read in batches
+// by a background thread (started by the first read).  An error in
+// the other source is passed on after the records that preceded it.
+class SegReadAheadSource : public SegSource {
+public:
+  explicit SegReadAheadSource(SegSource &source)
+    : source(source), batchPos(0),
+      fullBatches(pipeDepth), emptyBatches(pipeDepth + 2) {
+    batch.size = 0;
+  }
+
+  ~SegReadAheadSource() {
+    if (thread.joinable()) {
+      fullBatches.close();
+      thread.join();
+    }
+  }
+
+  bool read(Seg &s) {
+    if (!thread.joinable())
+      thread = std::thread(&SegReadAheadSource::run, this);
+    while (batchPos == batch.size) {
+      if (batch.error) std::rethrow_exception(batch.error);
+      batch.size = 0;
+      batchPos = 0;
+      emptyBatches.put(batch);  // recycle it: never waits
+      if (!fullBatches.get(batch)) return false;
+    }
+    moveSeg(batch.segs[batchPos++], s);
+    return true;
+  }
+
+private:
+  struct Batch {
+    std::vector<Seg> segs;
+    size_t size;
+    std::exception_ptr error;  // if reading stopped with an error
+  };
+
+  static const size_t batchSize = 1024;
+  SegSource &source;
+  Batch batch;
+  size_t batchPos;
+  Pipe<Batch> fullBatches;
+  Pipe<Batch> emptyBatches;
+  std::thread thread;
+
+  void run() {
+    while (true) {
+      Batch b;
+      emptyBatches.tryGet(b);
+      b.segs.resize(batchSize);
+      b.size = 0;
+      bool isEnd = false;
+      try {
+	while (b.size < batchSize && !isEnd) {
+	  if (source.read(b.segs[b.size])) ++b.size;
+	  else isEnd = true;
+	}
+      } catch (...) {
+	b.error = std::current_exception();
+	isEnd = true;
+      }
+      if (!fullBatches.put(b) || isEnd) break;
+    }
+    fullBatches.close();
+  }
+};
+
+// Gets segment-tuples from another source, which may be out of order
+// by up to maxShift records.  They are put in order with a small
+// priority queue, which is stable, so equal ones keep their order.
+class SegReorderSource : public SegSource {
+public:
+  SegReorderSource(SegSource &source, size_t maxShift)
+    : source(source), maxShift(maxShift), serial(0), isEnd(false) {}
+
+  bool read(Seg &s) {
+    while (!isEnd && queue.size() <= maxShift) {
+      queue.resize(queue.size() + 1);
+      Item &x = queue.back();
+      if (source.read(x.seg)) {
+	x.serial = serial++;
+	std::push_heap(queue.begin(), queue.end(), isAfter);
+      } else {
+	queue.pop_back();
+	isEnd = true;
+      }
+    }
+    if (queue.empty()) return false;
+    std::pop_heap(queue.begin(), queue.end(), isAfter);
+    moveSeg(queue.back().seg, s);
+    queue.pop_back();
+    return true;
+  }
+
+private:
+  struct Item {
+    Seg seg;
+    size_t serial;
+  };
+
+  SegSource &source;
+  size_t maxShift;
+  size_t serial;
+  bool isEnd;
+  std::vector<Item> queue;
+
+  static bool isAfter(const Item &x, const Item &y) {
+    int c = nameCmp(x.seg, y.seg, 0);
+    if (c) return c > 0;
+    if (beg0(x.seg) != beg0(y.seg)) return beg0(x.seg) > beg0(y.seg);
+    return x.serial > y.serial;
+  }
+};
+
+// Gets segment-tuples from a source, checking that they're in the
+// order produced by seg-sort
+class SortedSegReader {
+public:
+  explicit SortedSegReader(SegSource &source) : source(source) { next(); }
+
+  bool isMore() const { return !s.parts.empty(); }
+
+  bool isNewSeqName() const { return isNewSeq; }
+
+  const Seg &get() const { return s; }
+
+  void next() {
+    if (!source.read(t)) t.parts.clear();
+    if (s.parts.empty() || t.parts.empty()) {
+      isNewSeq = true;
+    } else {
+      int c = nameCmp(s, t, 0);
+      if (c > 0 || (c == 0 && beg0(s) > beg0(t)))
+	err("input not sorted properly");
+      isNewSeq = c;
+    }
+    moveSeg(t, s);
+  }
+
+private:
+  SegSource &source;
+  Seg s, t;
+  bool isNewSeq;
+};
+
+// Sorted segment-tuples, held in memory and indexed by first sequence
+// name, so that many joins can be done without reading them again
+class SegIndex {
+public:
+  explicit SegIndex(SortedSegReader &r) {
+    for ( ; r.isMore(); r.next()) {
+      const Seg &s = r.get();
+      if (r.isNewSeqName()) {
+	seqs.push_back(Sequence());
+	StringView n = seqName(s, 0);
+	seqNums[std::string(n.begin(), n.end())] = seqs.size() - 1;
+      }
+      Sequence &q = seqs.back();
+      long end = end0(s);
+      if (!q.maxEnds.empty()) end = std::max(end, q.maxEnds.back());
+      q.maxEnds.push_back(end);
+      q.segs.push_back(s);
+    }
+  }
+
+private:
+  friend class SegIndexSource;
+
+  struct Sequence {
+    std::vector<Seg> segs;
+    std::vector<long> maxEnds;  // the maximum end0 of segs[0], ..., segs[i]
+  };
+
+  std::vector<Sequence> seqs;
+  std::unordered_map<std::string, size_t> seqNums;
+};
+
+inline bool isBegLess(const Seg &s, long pos) {
+  return beg0(s) < pos;
+}
+
+// Gets the records from a SegIndex that might overlap the first
+// segments of some sorted query records
+class SegIndexSource : public SegSource {
+public:
+  SegIndexSource(const SegIndex &index, const std::vector<Seg> &querys)
+    : rangeNum(0) {
+    for (size_t i = 0; i < querys.size(); ) {
+      const Seg &q = querys[i];
+      long beg = beg0(q);
+      long end = end0(q);
+      for (++i; i < querys.size() && !nameCmp(q, querys[i], 0); ++i)
+	end = std::max(end, end0(querys[i]));
+      StringView n = seqName(q, 0);
+      std::unordered_map<std::string, size_t>::const_iterator f =
+	index.seqNums.find(std::string(n.begin(), n.end()));
+      if (f == index.seqNums.end()) continue;
+      const SegIndex::Sequence &x = index.seqs[f->second];
+      // the records before b end at or before beg, and the records
+      // from e onwards begin at or after end:
+      size_t b = std::upper_bound(x.maxEnds.begin(), x.maxEnds.end(), beg)
+	- x.maxEnds.begin();
+      size_t e = std::lower_bound(x.segs.begin(), x.segs.end(), end, isBegLess)
+	- x.segs.begin();
+      if (b < e) addRange(x.segs.data() + b, x.segs.data() + e);
+    }
+  }
+
+  bool read(Seg &s) {
+    while (rangeNum < ranges.size()) {
+      Range &r = ranges[rangeNum];
+      if (r.beg < r.end) {
+	s = *r.beg++;
+	return true;
+      }
+      ++rangeNum;
+    }
+    return false;
+  }
+
+private:
+  struct Range {
+    const Seg *beg;
+    const Seg *end;
+  };
+
+  std::vector<Range> ranges;
+  size_t rangeNum;
+
+  void addRange(const Seg *beg, const Seg *end) {
+    Range r = {beg, end};
+    ranges.push_back(r);
+  }
+};
+
+// Receives the results of a join
+class SegJoinSink {
+public:
+  virtual ~SegJoinSink() {}
+
+  // Gets a slice of s, whose first segment is [beg, end)
+  virtual void putSlice(const Seg &s, long beg, long end) = 0;
+
+  // Gets the join of s and t, whose first segment is [beg, end)
+  virtual void putJoin(const Seg &s, const Seg &t, long beg, long end) = 0;
+
+  // Gets s, of which "covered" bases overlap the other input
+  virtual void putCoverage(const Seg &s, long covered) {
+    putSlice(s, beg0(s), end0(s));
+  }
+};
+
+inline char *segSliceHead(char *e, const Seg &s, long beg, long end) {
+  e = writeLong(e, beg);
+  *--e = '\t';
+  e = writeName(e, s, 0);
+  *--e = '\t';
+  e = writeLong(e, end - beg);
+  return e;
+}
+
+inline char *segSliceTail(char *e, const Seg &s, long beg) {
+  long offset = beg - beg0(s);
+  for (size_t i = s.parts.size(); i --> 1; ) {
+    e = writeLong(e, segBeg(s, i) + offset);
+    *--e = '\t';
+    e = writeName(e, s, i);
+    *--e = '\t';
+  }
+  return e;
+}
+
+// Writes the results of a join as SEG text
+class SegJoinWriter : public SegJoinSink {
+public:
+  explicit SegJoinWriter(SegTextOutput &out) : out(out) {}
+
+  void putSlice(const Seg &s, long beg, long end) {
+    buffer.resize(maxTextSize(s) + 1);
+    char *bufferEnd = &buffer.back() + 1;
+    char *e = bufferEnd;
+    *--e = '\n';
+    e = segSliceTail(e, s, beg);
+    e = segSliceHead(e, s, beg, end);
+    out.write(e, bufferEnd - e);
+  }
+
+  void putCoverage(const Seg &s, long covered) {
+    buffer.resize(maxTextSize(s) + maxLongTextSize + 1);
+    char *bufferEnd = &buffer.back() + 1;
+    char *e = bufferEnd;
+    *--e = '\n';
+    e = writeLong(e, covered);
+    *--e = '\t';
+    e = segSliceTail(e, s, beg0(s));
+    e = segSliceHead(e, s, beg0(s), end0(s));
+    out.write(e, bufferEnd - e);
+  }
+
+  void putJoin(const Seg &s, const Seg &t, long beg, long end) {
+    buffer.resize(maxTextSize(s) + maxTextSize(t) + 1);
+    char *bufferEnd = &buffer.back() + 1;
+    char *e = bufferEnd;
+    *--e = '\n';
+    e = segSliceTail(e, t, beg);
+    e = segSliceTail(e, s, beg);
+    e = segSliceHead(e, s, beg, end);
+    out.write(e, bufferEnd - e);
+  }
+
+private:
+  SegTextOutput &out;
+  std::vector<char> buffer;
+};
+
+// Summarizes the results of a join, instead of writing them: how many
+// records, their total length, and the same for each distinct
+// sequence name in their Nth segment
+class SegJoinSummary : public SegJoinSink {
+public:
+  struct Count {
+    std::string name;
+    size_t records;
+    long bases;
+  };
+
+  explicit SegJoinSummary(size_t segmentNum) : segmentNum(segmentNum) {
+    totalCount.records = 0;
+    totalCount.bases = 0;
+  }
+
+  const Count &total() const { return totalCount; }
+
+  // The counts for each name, in order of first appearance
+  const std::vector<Count> &names() const { return counts; }
+
+  void putSlice(const Seg &s, long beg, long end) {
+    add(partName(s, segmentNum - 1), 1, end - beg);
+  }
+
+  void putCoverage(const Seg &s, long covered) {
+    add(partName(s, segmentNum - 1), 1, end0(s) - beg0(s));
+  }
+
+  void putJoin(const Seg &s, const Seg &t, long beg, long end) {
+    size_t i = segmentNum - 1;
+    size_t n = s.parts.size();
+    add(i < n ? partName(s, i) : partName(t, i - n + 1), 1, end - beg);
+  }
+
+  // Adds the counts of another summary, which comes after this one
+  void add(const SegJoinSummary &x) {
+    for (size_t i = 0; i < x.counts.size(); ++i) {
+      const Count &c = x.counts[i];
+      add(StringView(c.name), c.records, c.bases);
+    }
+  }
+
+private:
+  size_t segmentNum;
+  Count totalCount;
+  std::vector<Count> counts;
+  std::unordered_map<std::string, size_t> countNums;
+  std::string key;  // reused, to avoid allocating memory for lookups
+
+  StringView partName(const Seg &s, size_t i) const {
+    if (i >= s.parts.size()) {
+      char buf[maxLongTextSize];
+      char *e = buf + maxLongTextSize;
+      err("there's no segment " + std::string(writeLong(e, segmentNum), e) +
+	  " in the join output");
+    }
+    return seqName(s, i);
+  }
+
+  void add(StringView name, size_t records, long bases) {
+    totalCount.records += records;
+    totalCount.bases += bases;
+    key.assign(name.begin(), name.end());
+    std::unordered_map<std::string, size_t>::iterator f = countNums.find(key);
+    if (f == countNums.end()) {
+      f = countNums.insert(std::make_pair(key, counts.size())).first;
+      Count c = {key, 0, 0};
+      counts.push_back(c);
+    }
+    Count &c = counts[f->second];
+    c.records += records;
+    c.bases += bases;
+  }
+};
+
+inline bool isOverlappable(const Seg &s, const Seg &t) {
+  if (s.parts.size() != t.parts.size()) return false;
+  long d = beg0(s) - beg0(t);
+  for (size_t i = 1; i < s.parts.size(); ++i) {
+    if (nameCmp(s, t, i)) return false;
+    if (segBeg(s, i) - segBeg(t, i) != d) return false;
+  }
+  return true;
+}
+
+// How many kept records have been spilled to temporary files, and
+// how many bytes that took, in all joins so far
+struct SpillStats {
+  std::atomic<size_t> records;
+  std::atomic<size_t> bytes;
+};
+
+inline SpillStats &spillStats() {
+  static SpillStats stats;
+  return stats;
+}
+
+struct KeptSegs;
+
+// Kept records that were moved to a temporary file, to limit memory
+// use.  They're stored in the same order as in KeptSegs, and all of
+// them come before the ones still in memory.  Each batch of records
+// moved together is a "run", whose position and maximum end are
+// remembered, so a run whose records are all old is skipped without
+// reading it.  Other old records are skipped when reading, and the
+// file is rewritten only when most of it is old records.  The records
+// are stored in the computer's own format, so the file is only
+// meaningful to the process that wrote it.
+class KeptSegsSpill {
+public:
+  KeptSegsSpill() : file(newFile()), count(0), fileCount(0),
+		    oldPos(LONG_MIN), numOfLive(0), numOfLiveSeen(0) {}
+
+  ~KeptSegsSpill() { std::fclose(file); }
+
+  // How many records are stored, including old ones not yet removed
+  size_t size() const { return count; }
+
+  // Appends the kept records [beg, end)
+  void append(const KeptSegs &k, size_t beg, size_t end);
+
+  // Gets ready to read the records from the start
+  void rewind() {
+    if (std::fflush(file) != 0) err("can't write a temporary file");
+    runNum = 0;
+    readCount = 0;
+    readPos = -1;
+    numOfLiveSeen = 0;
+  }
+
+  // Reads up to maxSize of the records into "chunk", replacing what
+  // was there, skipping old ones.  Returns false if there are no more.
+  bool read(KeptSegs &chunk, size_t maxSize);
+
+  // Removes records that end at or before "pos"
+  void removeOld(long pos);
+
+private:
+  struct Head {
+    long beg;
+    long end;
+    unsigned long long signature;
+    size_t numOfParts;
+    size_t namesSize;
+  };
+
+  struct Run {
+    long beg;  // where it starts in the file
+    long end;
+    size_t count;
+    long maxEnd;
+  };
+
+  std::FILE *file;
+  std::deque<Run> runs;  // the ones with records that might not be old
+  size_t count;  // how many records are in the runs
+  size_t fileCount;  // how many records are in the file
+  long oldPos;  // records ending at or before this are old
+  size_t numOfLive;  // how many records the last full read didn't skip
+  size_t numOfLiveSeen;
+  size_t runNum;
+  size_t readCount;  // how many records of this run have been read
+  long readPos;  // where the file is at, or -1 if unknown
+  Seg seg;
+
+  static std::FILE *newFile() {
+    std::FILE *f = std::tmpfile();
+    if (!f) err("can't make a temporary file");
+    return f;
+  }
+
+  static void put(std::FILE *f, const void *x, size_t size) {
+    if (std::fwrite(x, 1, size, f) != size)
+      err("can't write a temporary file");
+  }
+
+  // Writes s, and returns the number of bytes written
+  static size_t put(std::FILE *f, const Seg &s) {
+    Head h = {beg0(s), end0(s), s.signature, s.parts.size(), s.names.size()};
+    put(f, &h, sizeof h);
+    put(f, s.parts.data(), s.parts.size() * sizeof(SegPart));
+    put(f, s.names.data(), s.names.size());
+    return sizeof h + s.parts.size() * sizeof(SegPart) + s.names.size();
+  }
+
+  void get(Seg &s) {
+    Head h;
+    if (std::fread(&h, sizeof h, 1, file) != 1)
+      err("can't read a temporary file");
+    s.parts.resize(h.numOfParts);
+    if (std::fread(s.parts.data(), sizeof(SegPart), h.numOfParts, file) !=
+	h.numOfParts) err("can't read a temporary file");
+    s.names.resize(h.namesSize);
+    if (std::fread(&s.names[0], 1, h.namesSize, file) != h.namesSize)
+      err("can't read a temporary file");
+    s.part0end = h.end;
+    s.signature = h.signature;
+  }
+};
+
+// The segments that might overlap the current query, in order of
+// their first start coordinates.  Their begin and end coordinates are
+// kept in separate, contiguous arrays, so that the inner loops don't
+// need to touch the Seg objects until something overlaps.  If maxBytes
+// isn't 0, and they take more memory than that, the oldest ones are
+// moved to a KeptSegsSpill.
+struct KeptSegs {
+  std::vector<long> begs;
+  std::vector<long> ends;
+  std::vector<unsigned long long> signatures;
+  std::vector<Seg> segs;  // can be longer than begs: spares get reused
+  size_t maxBytes;
+  size_t bytes;  // roughly, the memory used by begs, ends, etc.
+  std::unique_ptr<KeptSegsSpill> spill;
+
+  KeptSegs() : maxBytes(0), bytes(0) {}
+
+  static size_t bytesPerSeg(const Seg &s) {
+    return 2 * sizeof(long) + sizeof(unsigned long long) + sizeof(Seg) +
+      s.parts.size() * sizeof(SegPart) + s.names.size();
+  }
+
+  size_t size() const { return begs.size(); }
+
+  const Seg &operator[](size_t i) const { return segs[i]; }
+
+  void clear() {
+    begs.clear();
+    ends.clear();
+    signatures.clear();
+    bytes = 0;
+    spill.reset();
+  }
+
+  void add(const Seg &s) {
+    size_t n = size();
+    if (n < segs.size()) segs[n] = s;  // reuses the vector's memory
+    else segs.push_back(s);
+    begs.push_back(beg0(s));
+    ends.push_back(end0(s));
+    signatures.push_back(s.signature);
+    if (maxBytes) {
+      bytes += bytesPerSeg(s);
+      if (bytes > maxBytes) spillOldest();
+    }
+  }
+
+  // With -w, can s join the i-th of these?  The signatures reject
+  // most non-joinable ones without touching the Seg objects.
+  bool isOverlappable(const Seg &s, size_t i) const {
+    return signatures[i] == s.signature && mcf::isOverlappable(s, segs[i]);
+  }
+
+  // How many of these segments begin before "pos"?
+  size_t numBefore(long pos) const {
+    return std::lower_bound(begs.begin(), begs.end(), pos) - begs.begin();
+  }
+
+  // How many of these segments begin at or before "pos"?
+  size_t numUpTo(long pos) const {
+    return std::upper_bound(begs.begin(), begs.end(), pos) - begs.begin();
+  }
+
+  // Moves the older half to the spill file
+  void spillOldest() {
+    if (!spill) spill.reset(new KeptSegsSpill);
+    size_t n = (size() + 1) / 2;
+    spill->append(*this, 0, n);
+    begs.erase(begs.begin(), begs.begin() + n);
+    ends.erase(ends.begin(), ends.begin() + n);
+    signatures.erase(signatures.begin(), signatures.begin() + n);
+    segs.erase(segs.begin(), segs.begin() + n);
+    segs.resize(size());  // don't keep spares
+    bytes = 0;
+    for (size_t i = 0; i < size(); ++i) bytes += bytesPerSeg(segs[i]);
+  }
+};
+
+inline void KeptSegsSpill::append(const KeptSegs &k, size_t beg, size_t end) {
+  if (std::fseek(file, 0, SEEK_END) != 0) err("can't write a temporary file");
+  Run r = {std::ftell(file), 0, end - beg, LONG_MIN};
+  if (r.beg < 0) err("can't write a temporary file");
+  size_t size = 0;
+  for (size_t i = beg; i < end; ++i) {
+    size += put(file, k[i]);
+    r.maxEnd = std::max(r.maxEnd, k.ends[i]);
+  }
+  r.end = r.beg + size;
+  runs.push_back(r);
+  count += r.count;
+  fileCount += r.count;
+  numOfLive += r.count;
+  spillStats().records += r.count;
+  spillStats().bytes += size;
+}
+
+inline bool KeptSegsSpill::read(KeptSegs &chunk, size_t maxSize) {
+  chunk.clear();
+  while (runNum < runs.size() && chunk.size() < maxSize) {
+    const Run &r = runs[runNum];
+    if (readCount == 0) {
+      if (r.maxEnd <= oldPos) {
+	++runNum;
+	continue;
+      }
+      if (r.beg != readPos && std::fseek(file, r.beg, SEEK_SET) != 0)
+	err("can't read a temporary file");
+    }
+    get(seg);
+    if (end0(seg) > oldPos) {
+      chunk.add(seg);
+      ++numOfLiveSeen;
+    }
+    if (++readCount == r.count) {
+      ++runNum;
+      readCount = 0;
+      readPos = r.end;
+    }
+  }
+  if (runNum == runs.size()) numOfLive = numOfLiveSeen;
+  return chunk.size() > 0;
+}
+
+inline void KeptSegsSpill::removeOld(long pos) {
+  oldPos = std::max(oldPos, pos);
+  while (!runs.empty() && runs.front().maxEnd <= oldPos) {
+    count -= runs.front().count;
+    runs.pop_front();
+  }
+  if (runs.empty() || numOfLive * 2 >= fileCount) return;
+  std::FILE *f = newFile();
+  Run n = {0, 0, 0, LONG_MIN};
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const Run &r = runs[i];
+    if (r.maxEnd <= oldPos) continue;
+    if (std::fseek(file, r.beg, SEEK_SET) != 0)
+      err("can't read a temporary file");
+    for (size_t j = 0; j < r.count; ++j) {
+      get(seg);
+      if (end0(seg) > oldPos) {
+	n.end += put(f, seg);
+	n.maxEnd = std::max(n.maxEnd, end0(seg));
+	++n.count;
+      }
+    }
+  }
+  std::fclose(file);
+  file = f;
+  runs.assign(1, n);
+  count = fileCount = numOfLive = n.count;
+}
+
+inline void removeOldSegs(KeptSegs &keptSegs, long ibeg) {
+  if (keptSegs.spill) {
+    keptSegs.spill->removeOld(ibeg);
+    if (keptSegs.spill->size() == 0) keptSegs.spill.reset();
+  }
+  const long *ends = keptSegs.ends.data();
+  size_t end = keptSegs.size();
+  bool isCounting = keptSegs.maxBytes;
+  size_t j = 0;
+  for ( ; ; ++j) {
+    if (j == end) return;
+    if (ends[j] <= ibeg) break;
+  }
+  if (isCounting) keptSegs.bytes -= KeptSegs::bytesPerSeg(keptSegs.segs[j]);
+  for (size_t k = j + 1; k < end; ++k) {
+    if (ends[k] > ibeg) {
+      keptSegs.begs[j] = keptSegs.begs[k];
+      keptSegs.ends[j] = ends[k];
+      keptSegs.signatures[j] = keptSegs.signatures[k];
+      moveSeg(keptSegs.segs[k], keptSegs.segs[j]);
+      ++j;
+    } else if (isCounting) {
+      keptSegs.bytes -= KeptSegs::bytesPerSeg(keptSegs.segs[k]);
+    }
+  }
+  keptSegs.begs.resize(j);
+  keptSegs.ends.resize(j);
+  keptSegs.signatures.resize(j);
+}
+
+inline int newNameCmp(const Seg &s, const SortedSegReader &r) {
+  return r.isMore() ? nameCmp(s, r.get(), 0) : -1;
+}
+
+inline void skipOneSequence(SortedSegReader &r) {
+  do {
+    r.next();
+  } while (!r.isNewSeqName());
+}
+
+inline void updateKeptSegs(KeptSegs &keptSegs, SortedSegReader &r,
+			   const SortedSegReader &q) {
+  const Seg &s = q.get();
+  long ibeg = beg0(s);
+  long iend = end0(s);
+
+  if (q.isNewSeqName()) {
+    keptSegs.clear();
+    if (r.isNewSeqName()) {
+      while (true) {
+	int c = newNameCmp(s, r);
+	if (c < 0) return;
+	if (c == 0) break;
+	skipOneSequence(r);
+      }
+    } else {
+      while (true) {
+	skipOneSequence(r);
+	int c = newNameCmp(s, r);
+	if (c < 0) return;
+	if (c == 0) break;
+      }
+    }
+  } else {
+    removeOldSegs(keptSegs, ibeg);
+    if (r.isNewSeqName()) {
+      int c = newNameCmp(s, r);
+      if (c < 0) return;
+      assert(c == 0);
+    }
+  }
+
+  do {
+    const Seg &t = r.get();
+    long jbeg = beg0(t);
+    if (jbeg >= iend) break;
+    long jend = end0(t);
+    if (jend > ibeg) keptSegs.add(t);
+    r.next();
+  } while (!r.isNewSeqName());
+}
+
+// These functions join one query record, s, with the kept records.
+// If some kept records were spilled, they're scanned in several
+// chunks: the "scan" functions continue from the state left by the
+// previous chunk.
+
+// ibeg: how far s has been cut into unjoinable parts
+inline void scanUnjoinable(const Seg &s, const KeptSegs &keptSegs,
+			   bool isComplete, bool isAll, long &ibeg,
+			   SegJoinSink &out) {
+  long iend = end0(s);
+  const long *begs = keptSegs.begs.data();
+  const long *ends = keptSegs.ends.data();
+  size_t n = keptSegs.numBefore(iend);
+  for (size_t j = 0; j < n; ++j) {
+    if (isAll && !keptSegs.isOverlappable(s, j)) continue;
+    if (isComplete) {
+      ibeg = iend;
+      break;
+    }
+    long jbeg = begs[j];
+    long jend = ends[j];
+    if (jbeg > ibeg) out.putSlice(s, ibeg, jbeg);
+    if (jend > ibeg) ibeg = jend;
+  }
+}
+
+inline void finishUnjoinable(const Seg &s, long ibeg, SegJoinSink &out) {
+  long iend = end0(s);
+  if (iend > ibeg) out.putSlice(s, ibeg, iend);
+}
+
+// overlap: the length of s covered so far; kbeg: the end of that
+inline void scanOverlapping(const Seg &s, const KeptSegs &keptSegs,
+			    bool isAll, long &overlap, long &kbeg) {
+  long iend = end0(s);
+  const long *begs = keptSegs.begs.data();
+  const long *ends = keptSegs.ends.data();
+  size_t n = keptSegs.numBefore(iend);
+  for (size_t j = 0; j < n; ++j) {
+    long jbeg = begs[j];
+    long jend = ends[j];
+    if (jend <= kbeg) continue;
+    if (isAll && !keptSegs.isOverlappable(s, j)) continue;
+    long end = std::min(iend, jend);
+    overlap += end - std::max(jbeg, kbeg);
+    kbeg = end;
+  }
+}
+
+inline void finishOverlapping(const Seg &s, Fraction minFrac, bool isCoverage,
+			      long overlap, SegJoinSink &out) {
+  long ibeg = beg0(s);
+  long iend = end0(s);
+  if (overlap * minFrac.denom >= (iend - ibeg) * minFrac.numer) {
+    if (isCoverage) out.putCoverage(s, overlap);
+    else out.putSlice(s, ibeg, iend);
+  }
+}
+
+inline void joinOne(const Seg &s, const KeptSegs &keptSegs,
+		    bool isComplete1, bool isComplete2, bool isAll,
+		    SegJoinSink &out) {
+  long ibeg = beg0(s);
+  long iend = end0(s);
+  const long *begs = keptSegs.begs.data();
+  const long *ends = keptSegs.ends.data();
+  // the kept segments are sorted by begin coordinate, so the
+  // containment conditions on begin coordinates select a range:
+  size_t j = isComplete2 ? keptSegs.numBefore(ibeg) : 0;
+  size_t n = keptSegs.numBefore(iend);
+  if (isComplete1) n = std::min(n, keptSegs.numUpTo(ibeg));
+  for ( ; j < n; ++j) {
+    long jbeg = begs[j];
+    long jend = ends[j];
+    if (isComplete1 && iend > jend) continue;
+    if (isComplete2 && jend > iend) continue;
+    if (isAll && !keptSegs.isOverlappable(s, j)) continue;
+    long beg = std::max(ibeg, jbeg);
+    long end = std::min(iend, jend);
+    if (isAll) out.putSlice(s, beg, end);
+    else out.putJoin(s, keptSegs[j], beg, end);
+  }
+}
+
+// Is file 2 the one whose records are sent to the output?
+inline bool isQueryFile2(const SegJoinOptions &opts) {
+  return opts.unjoinableFileNumber ? opts.unjoinableFileNumber == 2
+    : opts.overlappingFileNumber == 2;
+}
+
+// Joins the records from r1 and r2, in the way specified by opts,
+// sending the results to "out".  It goes one "query" record at a
+// time, so that several joins can be interleaved.
+class SegJoiner {
+public:
+  SegJoiner(SortedSegReader &r1, SortedSegReader &r2,
+	    const SegJoinOptions &opts, SegJoinSink &out)
+    : querys(isQueryFile2(opts) ? r2 : r1),
+      refs(isQueryFile2(opts) ? r1 : r2), opts(opts), out(out) {
+    keptSegs.maxBytes = opts.maxMemory;
+  }
+
+  bool isMore() const { return querys.isMore(); }
+
+  // The reader of the records that are joined one at a time
+  const SortedSegReader &queryReader() const { return querys; }
+
+  // Joins the next query record
+  void step() {
+    const Seg &s = querys.get();
+    updateKeptSegs(keptSegs, refs, querys);
+    long ibeg = beg0(s);  // for unjoinable parts
+    long overlap = 0;     // for overlapping records
+    long kbeg = beg0(s);  // for overlapping records
+    if (keptSegs.spill) {
+      keptSegs.spill->rewind();
+      while (keptSegs.spill->read(spillChunk, spillChunkSize))
+	scan(s, spillChunk, ibeg, overlap, kbeg);
+    }
+    scan(s, keptSegs, ibeg, overlap, kbeg);
+    if (opts.unjoinableFileNumber) {
+      finishUnjoinable(s, ibeg, out);
+    } else if (opts.overlappingFileNumber) {
+      finishOverlapping(s, opts.minOverlap, opts.isCoverage, overlap, out);
+    }
+    querys.next();
+  }
+
+private:
+  static const size_t spillChunkSize = 1024;
+  SortedSegReader &querys;
+  SortedSegReader &refs;
+  const SegJoinOptions &opts;
+  SegJoinSink &out;
+  KeptSegs keptSegs;
+  KeptSegs spillChunk;
+
+  void scan(const Seg &s, const KeptSegs &k,
+	    long &ibeg, long &overlap, long &kbeg) {
+    bool isAll = opts.isJoinOnAllSegments;
+    if (opts.unjoinableFileNumber) {
+      bool isComplete = isQueryFile2(opts) ? opts.isComplete2
+	: opts.isComplete1;
+      scanUnjoinable(s, k, isComplete, isAll, ibeg, out);
+    } else if (opts.overlappingFileNumber) {
+      scanOverlapping(s, k, isAll, overlap, kbeg);
+    } else {
+      joinOne(s, k, opts.isComplete1, opts.isComplete2, isAll, out);
+    }
+  }
+};
+
+inline void segJoin(SortedSegReader &r1, SortedSegReader &r2,
+		    const SegJoinOptions &opts, SegJoinSink &out) {
+  SegJoiner joiner(r1, r2, opts, out);
+  while (joiner.isMore()) joiner.step();
+}
+
+inline bool isBefore(const Seg &x, const Seg &y) {
+  int c = nameCmp(x, y, 0);
+  return c ? c < 0 : beg0(x) < beg0(y);
+}
+
+// Runs several joins, interleaved so that their query records are
+// joined in sorted order.  If they share an input (via a SegTee),
+// this keeps them close together in it.
+inline void segJoinInterleaved(const std::vector<SegJoiner *> &joiners) {
+  while (true) {
+    SegJoiner *next = 0;
+    for (size_t i = 0; i < joiners.size(); ++i) {
+      SegJoiner *j = joiners[i];
+      if (!j->isMore()) continue;
+      const Seg &q = j->queryReader().get();
+      if (!next || isBefore(q, next->queryReader().get())) next = j;
+    }
+    if (!next) break;
+    next->step();
+  }
+}
+
+// Shares one source between several readers.  Each reader gets all
+// the records, in order, except that a reader of "reference" records
+// skips ones that its join can't use (see setQueryReader).  Records
+// are kept in memory until all the readers are past them.
+class SegTee {
+public:
+  class Reader : public SegSource {
+  public:
+    explicit Reader(SegTee &tee) : tee(tee), pos(tee.base), querys(0) {}
+
+    bool read(Seg &s) { return tee.get(*this, s); }
+
+    // Skip records that can't overlap this reader's current or
+    // future query records
+    void setQueryReader(const SortedSegReader &q) { querys = &q; }
+
+  private:
+    friend class SegTee;
+    SegTee &tee;
+    size_t pos;
+    const SortedSegReader *querys;
+
+    bool isUnneeded(const Seg &x) const {
+      if (!querys) return false;
+      if (!querys->isMore()) return true;
+      const Seg &q = querys->get();
+      int c = nameCmp(x, q, 0);
+      return c ? c < 0 : end0(x) <= beg0(q);
+    }
+  };
+
+  explicit SegTee(SegSource &source)
+    : source(source), base(0), trimSize(minTrimSize), isEnd(false) {}
+
+  ~SegTee() {
+    for (size_t i = 0; i < readers.size(); ++i) delete readers[i];
+  }
+
+  Reader &addReader() {
+    readers.push_back(new Reader(*this));
+    return *readers.back();
+  }
+
+private:
+  static const size_t minTrimSize = 1024;
+  SegSource &source;
+  std::deque<Seg> segs;
+  size_t base;  // the number of records dropped from the front
+  size_t trimSize;
+  bool isEnd;
+  std::vector<Reader *> readers;
+
+  bool get(Reader &r, Seg &s) {
+    while (true) {
+      if (r.pos == base + segs.size()) {
+	if (isEnd) return false;
+	if (segs.size() >= trimSize) trim();
+	segs.resize(segs.size() + 1);
+	if (!source.read(segs.back())) {
+	  segs.pop_back();
+	  isEnd = true;
+	  return false;
+	}
+      }
+      const Seg &x = segs[r.pos++ - base];
+      if (r.isUnneeded(x)) continue;
+      s = x;
+      return true;
+    }
+  }
+
+  void trim() {
+    size_t end = base + segs.size();
+    size_t minPos = end;
+    for (size_t i = 0; i < readers.size(); ++i) {
+      Reader &r = *readers[i];
+      while (r.pos < end && r.isUnneeded(segs[r.pos - base])) ++r.pos;
+      minPos = std::min(minPos, r.pos);
+    }
+    segs.erase(segs.begin(), segs.begin() + (minPos - base));
+    base = minPos;
+    trimSize = std::max(minTrimSize, segs.size() * 2);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Sorting SEG text in bounded memory, in the same order as seg-sort.
+
+#ifndef MCF_SEG_SORT_HH
+#define MCF_SEG_SORT_HH
+
+#include "mcf_seg_io.hh"
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace mcf {
+
+// Where to find the sort keys of one line of SEG text
+struct SegSortKey {
+  StringView line;  // without the newline
+  StringView name;  // the first sequence name
+  long start;       // the first start coordinate
+};
+
+inline void setSegSortKey(SegSortKey &k, StringView line) {
+  if (!line.empty() && line.back() == '\n') line.remove_suffix(1);
+  k.line = line;
+  StringView length;
+  if (!(line >> length >> k.name >> k.start))
+    err("bad SEG line: " + std::string(k.line.begin(), k.line.end()));
+}
+
+// The order of "LC_ALL=C sort -b -k2,2 -k3n": sequence name, then
+// start coordinate, then the whole line
+inline bool operator<(const SegSortKey &x, const SegSortKey &y) {
+  int c = x.name.compare(y.name);
+  if (c) return c < 0;
+  if (x.start != y.start) return x.start < y.start;
+  return x.line < y.line;
+}
+
+// Gathers lines of SEG text, and writes them, sorted, to another
+// SegTextOutput when finish is called.  When the gathered lines use
+// more than about maxMemory bytes, they're sorted and put aside in a
+// temporary file: at the end, these sorted runs are merged.
+class SegSortOutput : public SegTextOutput {
+public:
+  SegSortOutput(SegTextOutput &out, size_t maxMemory)
+    : out(out), maxMemory(maxMemory) {}
+
+  void write(const char *beg, size_t size) {
+    text.insert(text.end(), beg, beg + size);
+    if (size == 0 || beg[size - 1] != '\n') text.push_back('\n');
+    lineEnds.push_back(text.size());
+    if (text.size() + lineEnds.size() * sizeof(SegSortKey) >= maxMemory)
+      writeRun();
+  }
+
+  void finish() {
+    if (runs.empty()) {
+      writeSorted(out);
+    } else {
+      if (!lineEnds.empty()) writeRun();
+      mergeRuns(runs, out);
+      runs.clear();
+    }
+  }
+
+private:
+  // Merge at most this many runs at once, to limit open files
+  static const size_t maxMergeWidth = 64;
+
+  typedef std::vector<std::unique_ptr<SegTempOutput> > Runs;
+
+  SegTextOutput &out;
+  size_t maxMemory;
+  std::vector<char> text;
+  std::vector<size_t> lineEnds;
+  Runs runs;
+
+  void writeSorted(SegTextOutput &sortedOut) {
+    std::vector<SegSortKey> keys(lineEnds.size());
+    size_t beg = 0;
+    for (size_t i = 0; i < lineEnds.size(); ++i) {
+      const char *b = text.data();
+      setSegSortKey(keys[i], StringView(b + beg, b + lineEnds[i]));
+      beg = lineEnds[i];
+    }
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      StringView x = keys[i].line;
+      sortedOut.write(x.data(), x.size() + 1);  // include the newline
+    }
+    text.clear();
+    lineEnds.clear();
+  }
+
+  void writeRun() {
+    if (runs.size() == maxMergeWidth) {
+      SegTempOutput *merged = new SegTempOutput;
+      mergeRuns(runs, *merged);
+      runs.clear();
+      runs.push_back(std::unique_ptr<SegTempOutput>(merged));
+    }
+    SegTempOutput *run = new SegTempOutput;
+    runs.push_back(std::unique_ptr<SegTempOutput>(run));
+    writeSorted(*run);
+  }
+
+  struct RunReader {
+    LineReader reader;
+    StringView line;
+    SegSortKey key;
+    explicit RunReader(std::FILE *f) : reader(f, 1 << 16) {}
+    bool next() {
+      if (!reader.getRawLine(line)) return false;
+      setSegSortKey(key, line);
+      return true;
+    }
+  };
+
+  struct IsLaterRun {
+    const std::vector<std::unique_ptr<RunReader> > *readers;
+    bool operator()(size_t x, size_t y) const {
+      const RunReader &a = *(*readers)[x];
+      const RunReader &b = *(*readers)[y];
+      if (b.key < a.key) return true;
+      if (a.key < b.key) return false;
+      return x > y;
+    }
+  };
+
+  static void mergeRuns(Runs &runs, SegTextOutput &mergedOut) {
+    std::vector<std::unique_ptr<RunReader> > readers;
+    IsLaterRun isLater = {&readers};
+    std::priority_queue<size_t, std::vector<size_t>, IsLaterRun> heap(isLater);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      readers.push_back(std::unique_ptr<RunReader>
+			(new RunReader(runs[i]->rewound())));
+      if (readers[i]->next()) heap.push(i);
+    }
+    while (!heap.empty()) {
+      size_t i = heap.top();
+      heap.pop();
+      StringView x = readers[i]->line;
+      mergedOut.write(x.data(), x.size());
+      if (readers[i]->next()) heap.push(i);
+    }
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Per-line SEG operators: each segment-tuple is read, changed (or
+// omitted) by a SegTransform, and written.  This is what seg-shift and
+// seg-swap do.
+
+#ifndef MCF_SEG_TRANSFORM_HH
+#define MCF_SEG_TRANSFORM_HH
+
+#include "mcf_seg_join.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace mcf {
+
+class SegTransform {
+public:
+  virtual ~SegTransform() {}
+
+  // Changes s, or returns false if it should be omitted
+  virtual bool apply(Seg &s) = 0;
+};
+
+inline void writeSeg(SegTextOutput &out, const Seg &s,
+		     std::vector<char> &buffer) {
+  buffer.resize(maxTextSize(s) + 1);
+  char *bufferEnd = &buffer.back() + 1;
+  char *e = bufferEnd;
+  *--e = '\n';
+  e = segSliceTail(e, s, beg0(s));
+  e = segSliceHead(e, s, beg0(s), end0(s));
+  out.write(e, bufferEnd - e);
+}
+
+inline void transformSegs(std::istream &in, SegTransform &t,
+			  SegTextOutput &out) {
+  LineReader reader(in);
+  RecentNames recent;
+  Seg s;
+  std::vector<char> buffer;
+  while (readSeg(reader, recent, s))
+    if (t.apply(s)) writeSeg(out, s, buffer);
+}
+
+// Transforms the named files one after another, or standard input if
+// there are no names
+inline void transformSegFiles(char **fileNames, SegTransform &t,
+			      SegTextOutput &out) {
+  if (*fileNames) {
+    for (char **i = fileNames; *i; ++i) {
+      std::ifstream ifs;
+      std::istream &in = openIn(*i, ifs);
+      transformSegs(in, t, out);
+    }
+  } else {
+    transformSegs(std::cin, t, out);
+  }
+}
+
+// Swaps the Nth segment with the first, then (unless isKeepStrands)
+// flips all the strands if the first segment is reverse-stranded
+class SegSwapTransform : public SegTransform {
+public:
+  SegSwapTransform(size_t segmentNum, bool isKeepStrands)
+    : segmentNum(segmentNum), isKeepStrands(isKeepStrands) {}
+
+  bool apply(Seg &s) {
+    if (segmentNum > s.parts.size()) {
+      char buf[maxLongTextSize];
+      char *e = buf + maxLongTextSize;
+      err("there's no segment " + std::string(writeLong(e, segmentNum), e) +
+	  " in the input");
+    }
+    long length = end0(s) - beg0(s);
+    std::swap(s.parts[0], s.parts[segmentNum - 1]);
+    if (beg0(s) < 0 && !isKeepStrands) {
+      for (size_t i = 0; i < s.parts.size(); ++i)
+	s.parts[i].start = -length - s.parts[i].start;
+    }
+    setSegLength(s, length);
+    return true;
+  }
+
+private:
+  size_t segmentNum;
+  bool isKeepStrands;
+};
+
+// Expands each segment-tuple by begGrowth at the start and endGrowth
+// at the end (or shrinks it, if they're negative), but not past
+// coordinate 0 in any segment.  Omits it if its length would become
+// negative.
+class SegShiftTransform : public SegTransform {
+public:
+  SegShiftTransform(long begGrowth, long endGrowth)
+    : begGrowth(begGrowth), endGrowth(endGrowth) {}
+
+  bool apply(Seg &s) {
+    long length = end0(s) - beg0(s);
+    long b = begGrowth;
+    long e = endGrowth;
+    for (size_t i = 0; i < s.parts.size(); ++i) {
+      long x = s.parts[i].start;
+      if (x >= 0) b = std::min(b, x);
+      else        e = std::min(e, -(x + length));
+    }
+    length += b + e;
+    if (length < 0) return false;
+    for (size_t i = 0; i < s.parts.size(); ++i) s.parts[i].start -= b;
+    setSegLength(s, length);
+    return true;
+  }
+
+private:
+  long begGrowth;
+  long endGrowth;
+};
+
+}
+
+#endif
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Reading sequences, from FASTA or FASTQ text, or from UCSC .2bit
+// files.  A .2bit file has 4 bases packed in each byte, plus lists of
+// N-blocks and lowercase ("mask") blocks.  It's memory-mapped, so any
+// range of a sequence can be decoded without reading the rest.  This
+// is what seg-mask and seg-seq use.
+
+#ifndef MCF_SEQ_IO_HH
+#define MCF_SEQ_IO_HH
+
+#include "mcf_seg_io.hh"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace mcf {
+
+// A sequence from FASTA or FASTQ text
+struct SeqRecord {
+  std::string header;   // the first line, without its newline
+  std::string seq;
+  std::string header2;  // for FASTQ: the "+" line
+  std::string qual;     // for FASTQ
+};
+
+inline StringView seqRecordName(const SeqRecord &r) {
+  const char *b = r.header.c_str() + 1;
+  const char *e = r.header.c_str() + r.header.size();
+  while (b < e && !isGraph(*b)) ++b;
+  return StringView(b, graphEnd(b, e));
+}
+
+// Reads FASTA or FASTQ records, telling which by the first character
+class SeqReader {
+public:
+  explicit SeqReader(std::istream &in) : in(in), format(0) {}
+
+  bool read(SeqRecord &r) {
+    StringView line;
+    if (!format) {
+      if (!in.getLine(line)) return false;
+      format = line[0];
+      if (format != '>' && format != '@')
+	err("the sequence data must start with > or @");
+      next.assign(line.begin(), line.end());
+    } else if (format == '@') {
+      if (!in.getLine(line)) return false;
+      next.assign(line.begin(), line.end());
+    } else if (next.empty()) {
+      return false;
+    }
+    r.header.swap(next);
+    next.clear();
+    r.seq.clear();
+    r.header2.clear();
+    r.qual.clear();
+
+    if (format == '@') {
+      if (!in.getLine(line)) return false;
+      const char *e = line.end();
+      while (e > line.begin() && !isGraph(e[-1])) --e;
+      r.seq.assign(line.begin(), e);
+      if (!in.getLine(line)) return false;
+      r.header2.assign(line.begin(), line.end());
+      if (!in.getLine(line)) return false;
+      r.qual.assign(line.begin(), line.end());
+      return true;
+    }
+
+    while (in.getLine(line)) {
+      if (line[0] == '>') {
+	next.assign(line.begin(), line.end());
+	break;
+      }
+      for (const char *c = line.begin(); c < line.end(); ++c)
+	if (isGraph(*c)) r.seq.push_back(*c);
+    }
+    return true;
+  }
+
+private:
+  LineReader in;
+  char format;
+  std::string next;  // the next record's first line
+};
+
+const uint32_t twoBitSignature = 0x1A412743;
+
+inline uint32_t byteSwapped(uint32_t x) {
+  return (x >> 24) | (x >> 8 & 0xFF00) | (x << 8 & 0xFF0000) | (x << 24);
+}
+
+// Does the file start with a .2bit signature, in either byte order?
+// Only regular files are checked, because reading the start of a pipe
+// would lose it.
+inline bool isTwoBitFile(const char *fileName) {
+  if (isChar(fileName, '-')) return false;
+  struct stat st;
+  if (stat(fileName, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  std::ifstream f(fileName, std::ios::binary);
+  uint32_t x;
+  if (!f.read(reinterpret_cast<char *>(&x), sizeof x)) return false;
+  return x == twoBitSignature || x == byteSwapped(twoBitSignature);
+}
+
+// The 4 letters packed in each byte, from the highest bits down
+struct TwoBitLetters {
+  char letters[256][4];
+
+  TwoBitLetters() {
+    for (int i = 0; i < 256; ++i)
+      for (int j = 0; j < 4; ++j)
+	letters[i][j] = "TCAG"[i >> (6 - 2 * j) & 3];
+  }
+};
+
+inline const TwoBitLetters &twoBitLetters() {
+  static const TwoBitLetters t;
+  return t;
+}
+
+// Blocks of a .2bit sequence, sorted and not overlapping
+struct TwoBitBlocks {
+  std::vector<size_t> begs;
+  std::vector<size_t> ends;
+};
+
+// Changes the parts of seq, which has positions [beg, end), that are
+// in any of the blocks
+template<typename Edit>
+void editTwoBitBlocks(const TwoBitBlocks &blocks, size_t beg, size_t end,
+		      char *seq, Edit edit) {
+  const std::vector<size_t> &ends = blocks.ends;
+  size_t i = std::upper_bound(ends.begin(), ends.end(), beg) - ends.begin();
+  for ( ; i < ends.size() && blocks.begs[i] < end; ++i) {
+    char *b = seq + (std::max(blocks.begs[i], beg) - beg);
+    char *e = seq + (std::min(ends[i], end) - beg);
+    for ( ; b < e; ++b) *b = edit(*b);
+  }
+}
+
+inline char twoBitN(char) { return 'N'; }
+
+inline char twoBitLowercase(char c) { return c | 0x20; }
+
+// One sequence of a .2bit file, which stays valid while the file does
+struct TwoBitSequence {
+  StringView name;
+  size_t length;
+  TwoBitBlocks nBlocks;
+  TwoBitBlocks maskBlocks;
+  const unsigned char *dna;
+
+  // Writes the letters in [beg, end) to "out".  N-blocks become N,
+  // and, if isMask, mask-blocks become lowercase.
+  void get(size_t beg, size_t end, bool isMask, char *out) const {
+    const TwoBitLetters &t = twoBitLetters();
+    const unsigned char *d = dna;
+    char *o = out;
+    size_t i = beg;
+    for ( ; i < end && i % 4; ++i) *o++ = t.letters[d[i / 4]][i % 4];
+    for ( ; i + 4 <= end; i += 4, o += 4)
+      std::memcpy(o, t.letters[d[i / 4]], 4);
+    for ( ; i < end; ++i) *o++ = t.letters[d[i / 4]][i % 4];
+    editTwoBitBlocks(nBlocks, beg, end, out, twoBitN);
+    if (isMask) editTwoBitBlocks(maskBlocks, beg, end, out, twoBitLowercase);
+  }
+};
+
+class TwoBitFile {
+public:
+  explicit TwoBitFile(const char *fileName) : fileName(fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) err("can't open file: " + this->fileName);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      void *m = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+      data = (m == MAP_FAILED) ? 0 : static_cast<const unsigned char *>(m);
+    } else {
+      data = 0;
+    }
+    close(fd);
+    if (!data) err("can't read file: " + this->fileName);
+    setUp();
+  }
+
+  ~TwoBitFile() { munmap(const_cast<unsigned char *>(data), size); }
+
+  size_t numOfSequences() const { return names.size(); }
+
+  StringView name(size_t i) const { return names[i]; }
+
+  // Sets s to sequence number i
+  void get(size_t i, TwoBitSequence &s) const {
+    size_t pos = offsets[i];
+    s.name = names[i];
+    s.length = get32(pos);
+    getBlocks(pos + 4, s.nBlocks, pos);
+    getBlocks(pos, s.maskBlocks, pos);
+    pos += 4;  // reserved
+    if (pos > size || (s.length + 3) / 4 > size - pos) bad();
+    s.dna = data + pos;
+  }
+
+private:
+  std::string fileName;
+  const unsigned char *data;
+  size_t size;
+  bool isSwapped;
+  std::vector<StringView> names;
+  std::vector<size_t> offsets;
+
+  void bad() const { err("bad .2bit file: " + fileName); }
+
+  uint32_t get32(size_t pos) const {
+    if (pos > size || size - pos < 4) bad();
+    uint32_t x;
+    std::memcpy(&x, data + pos, 4);
+    return isSwapped ? byteSwapped(x) : x;
+  }
+
+  void getBlocks(size_t pos, TwoBitBlocks &b, size_t &end) const {
+    size_t count = get32(pos);
+    pos += 4;
+    if (count > (size - pos) / 8) bad();
+    b.begs.resize(count);
+    b.ends.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      b.begs[i] = get32(pos + i * 4);
+      b.ends[i] = b.begs[i] + get32(pos + (count + i) * 4);
+    }
+    end = pos + count * 8;
+  }
+
+  void setUp() {
+    isSwapped = false;
+    uint32_t signature = get32(0);
+    isSwapped = (signature != twoBitSignature);
+    if (isSwapped && signature != byteSwapped(twoBitSignature)) bad();
+    uint32_t version = get32(4);
+    if (version > 1) bad();
+    size_t count = get32(8);
+    size_t pos = 16;
+    for (size_t i = 0; i < count; ++i) {
+      if (pos >= size) bad();
+      size_t nameEnd = pos + 1 + data[pos];
+      if (nameEnd > size) bad();
+      const char *b = reinterpret_cast<const char *>(data + pos + 1);
+      names.push_back(StringView(b, b + data[pos]));
+      uint64_t offset = get32(nameEnd);
+      if (version) {
+	uint64_t high = get32(nameEnd + 4);
+	if (isSwapped) std::swap(offset, high);
+	offset |= high << 32;
+      }
+      offsets.push_back(offset);
+      pos = nameEnd + (version ? 8 : 4);
+    }
+  }
+};
+
+}
+
+#endif
@@ -28,6 +28,91 @@ inline bool isChar(const char *myString, char myChar) {
   return myString[0] == myChar && myString[1] == 0;
 }
 
+// Word-at-a-time ("SWAR") versions of the scanning loops: they look
+// at 8 chars per step, which needs little-endian loads.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MCF_SWAR 1
+#endif
+#endif
+
+#ifdef MCF_SWAR
+inline unsigned long long load8(const char *s) {
+  unsigned long long x;
+  std::memcpy(&x, s, 8);
+  return x;
+}
+
+inline bool isEightDigits(unsigned long long x) {
+  const unsigned long long hi = 0xF0F0F0F0F0F0F0F0ULL;
+  return ((x & hi) | (((x + 0x0606060606060606ULL) & hi) >> 4)) ==
+    0x3333333333333333ULL;
+}
+
+inline unsigned long eightDigitsValue(unsigned long long x) {
+  x -= 0x3030303030303030ULL;
+  x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FFULL;
+  x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFFULL;
+  x = (x * 10000 + (x >> 32)) & 0x00000000FFFFFFFFULL;
+  return x;
+}
+#endif
+
+// Returns the first char in [beg, end) that isn't isGraph
+inline const char *graphEnd(const char *beg, const char *end) {
+#ifdef MCF_SWAR
+  while (end - beg >= 8) {
+    unsigned long long x = load8(beg);
+    // flags bytes < '!' or >= 128: the lowest flag is always right
+    unsigned long long m = ((x - 0x2121212121212121ULL) | x) &
+      0x8080808080808080ULL;
+    if (m) return beg + __builtin_ctzll(m) / 8;
+    beg += 8;
+  }
+#endif
+  while (beg < end && isGraph(*beg)) ++beg;
+  return beg;
+}
+
+// Reads decimal digits in [beg, end) into "out".  Returns the end of
+// the digits, or 0 if the number exceeds "max".
+inline const char *readDigits(const char *beg, const char *end,
+			      unsigned long max, unsigned long &out) {
+  unsigned long z = 0;
+#ifdef MCF_SWAR
+  // 8 digits at a time, while that can't exceed max
+  const unsigned long maxEight = (max - 99999999) / 100000000;
+  while (end - beg >= 8 && z <= maxEight && isEightDigits(load8(beg))) {
+    z = z * 100000000 + eightDigitsValue(load8(beg));
+    beg += 8;
+  }
+#endif
+  while (beg < end && isDigit(*beg)) {
+    if (z > max / 10) return 0;
+    z *= 10;
+    unsigned long digit = *beg++ - '0';
+    if (z > max - digit) return 0;
+    z += digit;
+  }
+  out = z;
+  return beg;
+}
+
+// Reads a decimal integer, with optional '-', starting exactly at
+// "beg".  Returns the end of it, or 0 if it's absent or overflows.
+inline const char *readLong(const char *beg, const char *end, long &out) {
+  bool isNegative = (beg < end && *beg == '-');
+  if (isNegative) ++beg;
+  // should we allow an initial '+'?
+  if (beg == end || !isDigit(*beg)) return 0;
+  unsigned long max = LONG_MAX;
+  unsigned long z;
+  beg = readDigits(beg, end, max + isNegative, z);
+  if (!beg) return 0;
+  out = isNegative ? -static_cast<long>(z - 1) - 1 : z;
+  return beg;
+}
+
 class StringView {
 public:
   StringView() : b(0), e(0) {}
@@ -122,6 +207,10 @@ inline std::ostream &operator<<(std::ostream &out, StringView s) {
   return out.write(s.data(), s.size());
 }
 
+inline std::string operator+(const char *x, StringView y) {
+  return x + std::string(y.begin(), y.end());
+}
+
 inline StringView &operator>>(StringView &in, char &out) {
   const char *b = in.begin();
   const char *e = in.end();
@@ -142,8 +231,7 @@ inline StringView &operator>>(StringView &in, StringView &out) {
     if (isGraph(*b)) break;
     ++b;
   }
-  const char *m = b;
-  do { ++m; } while (m < e && isGraph(*m));
+  const char *m = graphEnd(b + 1, e);
   out = StringView(b, m);
   return in = StringView(m, e);
 }
@@ -158,14 +246,9 @@ inline StringView &operator>>(StringView &in, unsigned &out) {
   }
   // should we allow an initial '+'?
   if (!isDigit(*b)) return in = StringView();
-  unsigned z = *b++ - '0';
-  while (b < e && isDigit(*b)) {
-    if (z > UINT_MAX / 10) return in = StringView();
-    z *= 10;
-    unsigned digit = *b++ - '0';
-    if (z > UINT_MAX - digit) return in = StringView();
-    z += digit;
-  }
+  unsigned long z;
+  b = readDigits(b, e, UINT_MAX, z);
+  if (!b) return in = StringView();
   out = z;
   return in = StringView(b, e);
 }
@@ -178,31 +261,8 @@ inline StringView &operator>>(StringView &in, long &out) {
     if (isGraph(*b)) break;
     ++b;
   }
-  if (*b == '-') {
-    ++b;
-    if (b == e || !isDigit(*b)) return in = StringView();
-    long z = '0' - *b++;
-    while (b < e && isDigit(*b)) {
-      if (z < LONG_MIN / 10) return in = StringView();
-      z *= 10;
-      long digit = *b++ - '0';
-      if (z < LONG_MIN + digit) return in = StringView();
-      z -= digit;
-    }
-    out = z;
-  } else {
-    // should we allow an initial '+'?
-    if (!isDigit(*b)) return in = StringView();
-    long z = *b++ - '0';
-    while (b < e && isDigit(*b)) {
-      if (z > LONG_MAX / 10) return in = StringView();
-      z *= 10;
-      long digit = *b++ - '0';
-      if (z > LONG_MAX - digit) return in = StringView();
-      z += digit;
-    }
-    out = z;
-  }
+  b = readLong(b, e, out);
+  if (!b) return in = StringView();
   return in = StringView(b, e);
 }
 
@@ -1,119 +1,27 @@
 // Author: Martin C. Frith 2015
 // SPDX-License-Identifier: GPL-3.0-or-later
 
+#include "mcf_seg_binary.hh"
+#include "mcf_seg_join.hh"
+
 #include <getopt.h>
 
 #include <algorithm>
-#include <cassert>
-#include <climits>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <stddef.h>  // size_t
-#include <stdexcept>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-typedef const char *String;
-
-struct Fraction {
-  double numer;
-  double denom;
-};
-
-struct SegJoinOptions {
-  bool isComplete1;
-  bool isComplete2;
-  int overlappingFileNumber;
-  int unjoinableFileNumber;
-  bool isJoinOnAllSegments;
-  Fraction minOverlap;
-  const char *fileName1;
-  const char *fileName2;
-};
-
-static void err(const std::string& s) {
-  throw std::runtime_error(s);
-}
-
-static bool isGraph(char c) {
-  return c > ' ';  // faster than std::isgraph
-}
-
-static bool isSpace(char c) {
-  return c > 0 && c <= ' ';  // faster than std::isspace
-}
-
-static bool isDigit(char c) {
-  return c >= '0' && c <= '9';
-}
-
-static bool isChar(const char *myString, char myChar) {
-  return myString[0] == myChar && myString[1] == 0;
-}
-
-static std::istream &openIn(const char *fileName, std::ifstream &ifs) {
-  if (isChar(fileName, '-')) return std::cin;
-  ifs.open(fileName);
-  if (!ifs) err("can't open file: " + std::string(fileName));
-  return ifs;
-}
-
-static const char *readLong(const char *c, long &x) {
-  if (!c) return 0;
-  while (isSpace(*c)) ++c;
-  if (*c == '-') {
-    ++c;
-    if (!isDigit(*c)) return 0;
-    long z = '0' - *c++;
-    while (isDigit(*c)) {
-      if (z < LONG_MIN / 10) return 0;
-      z *= 10;
-      long digit = *c++ - '0';
-      if (z < LONG_MIN + digit) return 0;
-      z -= digit;
-    }
-    x = z;
-  } else {
-    // should we allow an initial '+'?
-    if (!isDigit(*c)) return 0;
-    long z = *c++ - '0';
-    while (isDigit(*c)) {
-      if (z > LONG_MAX / 10) return 0;
-      z *= 10;
-      long digit = *c++ - '0';
-      if (z > LONG_MAX - digit) return 0;
-      z += digit;
-    }
-    x = z;
-  }
-  return c;
-}
-
-// This writes a "long" integer into a char buffer ending at "end".
-// It writes backwards from the end, because that's easier & faster.
-static char *writeLong(char *end, long x) {
-  unsigned long y = x;
-  if (x < 0) y = -y;
-  do {
-    *--end = '0' + y % 10;
-    y /= 10;
-  } while (y);
-  if (x < 0) *--end = '-';
-  return end;
-}
-
-static const char *readWord(const char *c, String &s) {
-  if (!c) return 0;
-  while (isSpace(*c)) ++c;
-  const char *e = c;
-  while (isGraph(*e)) ++e;
-  if (e == c) return 0;
-  s = c;
-  return e;
-}
+using namespace mcf;
 
 static const char *readFraction(const char *c, Fraction &f) {
   if (!c) return 0;
@@ -131,332 +39,923 @@ static const char *readFraction(const char *c, Fraction &f) {
   return e;
 }
 
-static bool isDataLine(const char *s) {
-  for ( ; ; ++s) {
-    if (*s == '#') return false;
-    if (isGraph(*s)) return true;
-    if (*s == 0) return false;
+// Sets one of the options that say what kind of join to do
+static void setJoinOption(SegJoinOptions &opts, int c, const char *arg) {
+  switch (c) {
+  case 'c':
+    if      (isChar(arg, '1')) opts.isComplete1 = true;
+    else if (isChar(arg, '2')) opts.isComplete2 = true;
+    else err("option -c: should be 1 or 2");
+    break;
+  case 'f':
+    if (opts.overlappingFileNumber) err("option -f: cannot use twice");
+    else if (isChar(arg, '1')) opts.overlappingFileNumber = 1;
+    else if (isChar(arg, '2')) opts.overlappingFileNumber = 2;
+    else err("option -f: should be 1 or 2");
+    break;
+  case 'n':
+    if (opts.minOverlap.denom) err("option -n/-x: cannot use twice");
+    if (!readFraction(arg, opts.minOverlap))
+      err("option -n: bad value");
+    break;
+  case 'x':
+    if (opts.minOverlap.denom) err("option -n/-x: cannot use twice");
+    if (!readFraction(arg, opts.minOverlap))
+      err("option -x: bad value");
+    opts.minOverlap.numer *= -1;
+    opts.minOverlap.denom *= -1;
+    break;
+  case 'l':
+    opts.isCoverage = true;
+    break;
+  case 'v':
+    if (opts.unjoinableFileNumber) err("option -v: cannot use twice");
+    else if (isChar(arg, '1')) opts.unjoinableFileNumber = 1;
+    else if (isChar(arg, '2')) opts.unjoinableFileNumber = 2;
+    else err("option -v: should be 1 or 2");
+    break;
+  case 'w':
+    opts.isJoinOnAllSegments = true;
+    break;
   }
 }
 
-static bool getDataLine(std::istream &in, std::string &line) {
-  while (getline(in, line))
-    if (isDataLine(line.c_str()))
-      return true;
-  return false;
+// Fills in the implications of the join options
+static void finishJoinOptions(SegJoinOptions &opts) {
+  if (opts.isCoverage && opts.unjoinableFileNumber)
+    err("can't combine option -l with option -v");
+
+  if (opts.isCoverage && !opts.overlappingFileNumber &&
+      !opts.minOverlap.denom) {  // write all records of file 2
+    opts.overlappingFileNumber = 2;
+    opts.minOverlap.numer = 0;
+    opts.minOverlap.denom = 1;
+  }
+
+  if (opts.minOverlap.denom && !opts.overlappingFileNumber) {
+    opts.overlappingFileNumber = 2;
+  }
+
+  if (opts.overlappingFileNumber && !opts.minOverlap.denom) {
+    opts.minOverlap.numer = 1;
+    unsigned long x = -1;
+    opts.minOverlap.denom = x / 2 + 1;
+  }
 }
 
-struct SegPart {
-  size_t seqNameBeg;
-  size_t seqNameLen;
-  long start;
+struct SegInputOptions {
+  bool isPipelined;
+  size_t maxShift;  // allow records this far out of order
 };
 
-struct Seg {
-  std::string line;
-  long part0end;
-  std::vector<SegPart> parts;
+struct ByteRange {
+  size_t beg;
+  size_t end;
+};
+
+// Gets segment-tuples from some byte ranges of a SEG file
+class SegRangesSource : public SegSource {
+public:
+  SegRangesSource(std::istream &in, const std::vector<ByteRange> &ranges)
+    : in(in), ranges(ranges), rangeNum(0), pos(0), end(0), beg(0) {}
+
+  bool read(Seg &s) {
+    while (true) {
+      if (pos >= end) {
+	if (rangeNum == ranges.size()) {
+	  beg = pos;
+	  return false;
+	}
+	const ByteRange &r = ranges[rangeNum++];
+	if (r.beg != pos) in.seek(r.beg);
+	pos = r.beg;
+	end = r.end;
+      }
+      beg = pos;
+      StringView line;
+      if (!in.getLine(line)) {
+	pos = end;
+	continue;
+      }
+      pos = in.offset();
+      if (isDataLine(line.data())) {
+	parseSeg(line, recentNames, s);
+	return true;
+      }
+    }
+  }
+
+  // Where the last record read starts, or the end of the last range
+  // if there are no more records
+  size_t recordBeg() const { return beg; }
+
+private:
+  LineReader in;
+  const std::vector<ByteRange> &ranges;
+  size_t rangeNum;
+  size_t pos;
+  size_t end;
+  size_t beg;
+  RecentNames recentNames;
 };
 
-static long segBeg(const Seg &s, size_t i) {
-  return s.parts[i].start;
+static SegBinaryFile *newSegBinaryFile(const char *fileName) {
+  return isSegBinaryFile(fileName) ? new SegBinaryFile(fileName) : 0;
 }
 
-static long beg0(const Seg &s) {
-  return s.parts[0].start;
+// One input file, read in the ways specified by the options.  If
+// "ranges" isn't null, only those parts of the file are read.  A
+// binary SEG file is read directly, ignoring the options.
+struct SegInput {
+  SegInput(const char *fileName, const SegInputOptions &opts,
+	   const std::vector<ByteRange> *ranges = 0)
+    : binary(newSegBinaryFile(fileName)),
+      binarySource(binary ? new SegBinarySource(*binary) : 0),
+      in(openIn(fileName, ifs)), whole(in),
+      part(in, ranges ? *ranges : noRanges),
+      text(ranges ? static_cast<SegSource &>(part) : whole),
+      reordered(text, opts.maxShift),
+      readAhead(opts.maxShift ? static_cast<SegSource &>(reordered) : text),
+      source(binary ? *binarySource
+	     : opts.isPipelined ? readAhead
+	     : opts.maxShift ? static_cast<SegSource &>(reordered) : text) {}
+
+  std::unique_ptr<SegBinaryFile> binary;
+  std::unique_ptr<SegBinarySource> binarySource;
+  std::ifstream ifs;
+  std::istream &in;
+  std::vector<ByteRange> noRanges;
+  SegStreamSource whole;
+  SegRangesSource part;
+  SegSource &text;
+  SegReorderSource reordered;
+  SegReadAheadSource readAhead;
+  SegSource &source;
+};
+
+struct SegSummaryOptions {
+  size_t segmentNum;  // if 0, write the join, not a summary
+  bool isPerName;     // write one line per name in segment segmentNum
+};
+
+static void writeSummary(const SegJoinSummary &summary, bool isPerName) {
+  if (isPerName) {
+    const std::vector<SegJoinSummary::Count> &names = summary.names();
+    for (size_t i = 0; i < names.size(); ++i) {
+      const SegJoinSummary::Count &c = names[i];
+      std::cout << c.name << '\t' << c.records << '\t' << c.bases << '\n';
+    }
+  } else {
+    const SegJoinSummary::Count &c = summary.total();
+    std::cout << c.records << '\t' << c.bases << '\t'
+	      << summary.names().size() << '\n';
+  }
 }
 
-static long end0(const Seg &s) {
-  return s.part0end;
+static void segJoin(const SegJoinOptions &opts, const SegInputOptions &inOpts,
+		    const SegOutputOptions &outOpts,
+		    const SegSummaryOptions &sumOpts,
+		    const char *fileName1, const char *fileName2) {
+  SegInput in1(fileName1, inOpts);
+  SegInput in2(fileName2, inOpts);
+  SortedSegReader r1(in1.source);
+  SortedSegReader r2(in2.source);
+  if (sumOpts.segmentNum) {
+    SegJoinSummary summary(sumOpts.segmentNum);
+    segJoin(r1, r2, opts, summary);
+    writeSummary(summary, sumOpts.isPerName);
+    return;
+  }
+  SegDestination output(outOpts, inOpts.isPipelined);
+  SegJoinWriter writer(output.get());
+  segJoin(r1, r2, opts, writer);
+  output.finish();
 }
 
-static void moveSeg(Seg &from, Seg &to) {
-  swap(from.line, to.line);
-  to.part0end = from.part0end;
-  swap(from.parts, to.parts);
+// One join of a fan-out, between one file 1 and the shared file 2
+struct FanOutJoin {
+  FanOutJoin(const SegJoinOptions &opts, const SegInputOptions &inOpts,
+	     const char *fileName1, const std::string &outName,
+	     SegTee::Reader &teeReader)
+    : in1(fileName1, inOpts), r1(in1.source), r2(teeReader),
+      file(outName.c_str()), output(file), writer(output),
+      joiner(r1, r2, opts, writer) {
+    if (!file) err("can't open file: " + outName);
+    if (!isQueryFile2(opts)) teeReader.setQueryReader(joiner.queryReader());
+  }
+
+  SegInput in1;
+  SortedSegReader r1;
+  SortedSegReader r2;
+  std::ofstream file;
+  SegOutput output;
+  SegJoinWriter writer;
+  SegJoiner joiner;
+};
+
+// Joins each of several files with the last file, which is read once
+static void segJoinFanOut(const SegJoinOptions &opts,
+			  const SegInputOptions &inOpts,
+			  char **fileNames, size_t numOfFiles,
+			  const std::string &outSuffix) {
+  SegInput in2(fileNames[numOfFiles - 1], inOpts);
+  SegTee tee(in2.source);
+  std::vector<std::unique_ptr<FanOutJoin> > joins;
+  std::vector<SegJoiner *> joiners;
+  for (size_t i = 0; i + 1 < numOfFiles; ++i) {
+    const char *f = fileNames[i];
+    if (isChar(f, '-')) err("option -m: can't read file 1 from a pipe");
+    FanOutJoin *j =
+      new FanOutJoin(opts, inOpts, f, f + outSuffix, tee.addReader());
+    joins.push_back(std::unique_ptr<FanOutJoin>(j));
+    joiners.push_back(&j->joiner);
+  }
+  segJoinInterleaved(joiners);
+  for (size_t i = 0; i < joins.size(); ++i) {
+    FanOutJoin &j = *joins[i];
+    j.output.finish();
+    j.file.close();
+    if (!j.file) err("can't write file: " + std::string(fileNames[i]) +
+		     outSuffix);
+  }
 }
 
-static int nameCmp(const Seg &x, const Seg &y, size_t part) {
-  const SegPart &xp = x.parts[part];
-  const SegPart &yp = y.parts[part];
-  size_t n = std::min(xp.seqNameLen, yp.seqNameLen);
-  int c = std::memcmp(x.line.c_str() + xp.seqNameBeg,
-		      y.line.c_str() + yp.seqNameBeg, n);
-  return c ? c : xp.seqNameLen - yp.seqNameLen;
+static bool isSegLess(const Seg &x, const Seg &y) {
+  int c = nameCmp(x, y, 0);
+  return c ? c < 0 : beg0(x) < beg0(y);
 }
 
-static char *writeName(char *end, const Seg &s, size_t part) {
-  const SegPart &p = s.parts[part];
-  end -= p.seqNameLen;
-  std::memcpy(end, s.line.c_str() + p.seqNameBeg, p.seqNameLen);
-  return end;
+// Sets the join options at the start of a request's words, in the
+// same way as getopt, but without its global state.  Returns the
+// number of words used.
+static size_t readRequestOptions(const std::vector<std::string> &words,
+				 const std::string &line, SegJoinOptions &opts) {
+  size_t i = 0;
+  for ( ; i < words.size(); ++i) {
+    const std::string &w = words[i];
+    if (w == "--") return i + 1;
+    if (w.size() < 2 || w[0] != '-') break;
+    for (size_t j = 1; j < w.size(); ++j) {
+      char c = w[j];
+      if (c == 'l' || c == 'w') {
+	setJoinOption(opts, c, 0);
+      } else if (c == 'c' || c == 'f' || c == 'n' || c == 'x' || c == 'v') {
+	const char *arg = w.c_str() + j + 1;
+	if (!*arg) {
+	  if (++i == words.size()) err("bad option in: " + line);
+	  arg = words[i].c_str();
+	}
+	setJoinOption(opts, c, arg);
+	break;
+      } else {
+	err("bad option in: " + line);
+      }
+    }
+  }
+  return i;
 }
 
-static bool readSeg(std::istream &in, Seg &s) {
-  s.parts.clear();
-  if (!getDataLine(in, s.line)) return false;
-  const char *b = s.line.c_str();
-  long length;
-  const char *c = readLong(b, length);
-  SegPart p;
-  while (true) {
-    const char *n;
-    c = readWord(c, n);
-    if (!c) break;
-    p.seqNameBeg = n - b;
-    p.seqNameLen = c - n;
-    c = readLong(c, p.start);
-    if (!c) err("bad SEG line: " + s.line);
-    s.parts.push_back(p);
-  }
-  if (s.parts.empty()) err("bad SEG line: " + s.line);
-  s.part0end = beg0(s) + length;
+// Reads one request: a line with join options and an index file name,
+// then query records, up to an empty line.  Returns false at the end
+// of the input.  If the request is bad, "error" gets a message.
+static bool readRequest(std::istream &in, const SegJoinOptions &defaults,
+			SegJoinOptions &opts, std::string &fileName,
+			std::vector<Seg> &querys, std::string &error) {
+  std::string line;
+  do {
+    if (!getline(in, line)) return false;
+  } while (!isDataLine(line.c_str()));
+
+  error.clear();
+  querys.clear();
+  try {
+    opts = defaults;
+    std::istringstream text(line);
+    std::vector<std::string> words;
+    std::string w;
+    while (text >> w) words.push_back(w);
+    size_t i = readRequestOptions(words, line, opts);
+    finishJoinOptions(opts);
+    if (i + 1 != words.size()) err("need one file name in: " + line);
+    fileName = words[i];
+    if (opts.unjoinableFileNumber == 2 ||
+	(opts.overlappingFileNumber == 2 && opts.minOverlap.numer <= 0))
+      err("can't get loaded records that overlap no query, in: " + line);
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+
+  RecentNames recentNames;
+  while (getline(in, line) && !line.empty()) {
+    if (!error.empty() || !isDataLine(line.c_str())) continue;
+    try {
+      querys.resize(querys.size() + 1);
+      parseSeg(StringView(line), recentNames, querys.back());
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+  }
   return true;
 }
 
-struct SortedSegReader {
-  SortedSegReader(const char *fileName) : in(openIn(fileName, ifs)) { next(); }
-
-  bool isMore() const { return !s.parts.empty(); }
+// Loads the files into memory, then answers join requests from
+// standard input, ending each response with an empty line
+static void segJoinServer(const SegJoinOptions &defaults,
+			  const SegInputOptions &inOpts,
+			  char **fileNames, size_t numOfFiles) {
+  std::unordered_map<std::string, std::unique_ptr<SegIndex> > indexes;
+  for (size_t i = 0; i < numOfFiles; ++i) {
+    SegInput in(fileNames[i], inOpts);
+    SortedSegReader r(in.source);
+    indexes[fileNames[i]].reset(new SegIndex(r));
+  }
 
-  bool isNewSeqName() const { return isNewSeq; }
+  SegOutput output(std::cout);
+  SegJoinWriter writer(output);
+  SegJoinOptions opts;
+  std::string fileName, error;
+  std::vector<Seg> querys;
+  while (readRequest(std::cin, defaults, opts, fileName, querys, error)) {
+    if (error.empty()) {
+      try {
+	if (!indexes.count(fileName)) err("not loaded: " + fileName);
+	const SegIndex &index = *indexes[fileName];
+	std::stable_sort(querys.begin(), querys.end(), isSegLess);
+	SegVectorSource qs(querys);
+	SegIndexSource rs(index, querys);
+	SortedSegReader r1(qs);
+	SortedSegReader r2(rs);
+	segJoin(r1, r2, opts, writer);
+      } catch (const std::exception &e) {
+	error = e.what();
+      }
+    }
+    if (!error.empty()) {
+      std::string text = "# error: " + error + "\n";
+      output.write(text.data(), text.size());
+    }
+    output.write("\n", 1);
+    output.finish();
+    if (!std::cout.flush()) err("write error");
+  }
+}
 
-  const Seg &get() const { return s; }
+// The lines for one first-sequence name, in a sorted SEG file
+struct SeqBlock {
+  std::string name;
+  ByteRange range;
+  Hash checksum;
+};
 
-  void next() {
-    readSeg(in, t);
-    if (s.parts.empty() || t.parts.empty()) {
-      isNewSeq = true;
-    } else {
-      int c = nameCmp(s, t, 0);
-      if (c > 0 || (c == 0 && beg0(s) > beg0(t)))
+static void readSeqBlocks(const char *fileName, std::vector<SeqBlock> &blocks) {
+  std::ifstream f(fileName, std::ios::binary);
+  if (!f) err("can't open file: " + std::string(fileName));
+  LineReader in(f);
+  StringView line;
+  size_t pos = 0;
+  while (in.getLine(line)) {
+    size_t beg = pos;
+    pos = in.offset();
+    if (!isDataLine(line.data())) continue;
+    const char *b = line.data();
+    StringView name = firstSeqName(b, b + line.size());
+    if (blocks.empty() || name != StringView(blocks.back().name)) {
+      if (!blocks.empty() && name < StringView(blocks.back().name))
 	err("input not sorted properly");
-      isNewSeq = c;
+      SeqBlock x;
+      x.name.assign(name.begin(), name.end());
+      x.range.beg = beg;
+      x.checksum = 0xCBF29CE484222325ULL;
+      blocks.push_back(x);
+    }
+    SeqBlock &x = blocks.back();
+    x.range.end = pos;
+    for (size_t i = 0; i < line.size(); ++i) {
+      unsigned char c = line[i];
+      x.checksum = hashMix(x.checksum, c);
     }
-    moveSeg(t, s);
+    x.checksum = hashMix(x.checksum, '\n');
   }
+}
 
-  std::ifstream ifs;
-  std::istream& in;
-  Seg s, t;
-  bool isNewSeq;
+// What incremental mode knows about one first-sequence name
+struct SeqSums {
+  std::string name;
+  Hash checksum1;  // of its lines in file 1, or 0 if there are none
+  Hash checksum2;  // of its lines in file 2, or 0 if there are none
+  ByteRange output;  // its lines in the output
+  bool isReused;  // are its lines copied from the old output?
 };
 
-static char *segSliceHead(char *e, const Seg &s, long beg, long end) {
-  e = writeLong(e, beg);
-  *--e = '\t';
-  e = writeName(e, s, 0);
-  *--e = '\t';
-  e = writeLong(e, end - beg);
-  return e;
+// The join options, as text, so we can check they haven't changed
+static std::string optionsText(const SegJoinOptions &opts) {
+  std::ostringstream s;
+  s.precision(17);
+  s << opts.isComplete1 << opts.isComplete2 << opts.overlappingFileNumber
+    << opts.unjoinableFileNumber << opts.isJoinOnAllSegments
+    << opts.isCoverage << ' '
+    << opts.minOverlap.numer << '/' << opts.minOverlap.denom;
+  return s.str();
 }
 
-static char *segSliceTail(char *e, const Seg &s, long beg) {
-  long offset = beg - beg0(s);
-  for (size_t i = s.parts.size(); i --> 1; ) {
-    e = writeLong(e, segBeg(s, i) + offset);
-    *--e = '\t';
-    e = writeName(e, s, i);
-    *--e = '\t';
+static const char sumsTag[] = "#seg-join-sums";
+
+static size_t fileSize(const std::string &fileName) {
+  std::ifstream f(fileName.c_str(), std::ios::binary | std::ios::ate);
+  return f ? static_cast<size_t>(f.tellg()) : -1;
+}
+
+// Reads the sums from a previous run, if they exist, and if they fit
+// the previous output file and the current options
+static void readSums(const std::string &sumsName, const std::string &outName,
+		     const std::string &optsText,
+		     std::unordered_map<std::string, SeqSums> &oldSums) {
+  std::ifstream in(sumsName.c_str());
+  std::string tag, line;
+  size_t outSize;
+  if (!(in >> tag >> outSize) || !getline(in, line)) return;
+  if (tag != sumsTag || line != "\t" + optsText) return;
+  if (fileSize(outName) != outSize) return;
+  SeqSums x;
+  while (in >> x.name >> x.checksum1 >> x.checksum2
+	 >> x.output.beg >> x.output.end) {
+    if (x.output.beg > x.output.end || x.output.end > outSize)
+      err("bad file: " + sumsName);
+    oldSums[x.name] = x;
   }
-  return e;
+  if (!in.eof()) err("bad file: " + sumsName);
 }
 
-std::vector<char> buffer;
-
-static void writeSegSlice(const Seg &s, long beg, long end) {
-  size_t maxChangedStarts = s.parts.size();
-  size_t space = s.line.size() + 32 * maxChangedStarts;
-  buffer.resize(space);
-  char *bufferEnd = &buffer.back() + 1;
-  char *e = bufferEnd;
-  *--e = '\n';
-  e = segSliceTail(e, s, beg);
-  e = segSliceHead(e, s, beg, end);
-  std::cout.write(e, bufferEnd - e);
+static void writeSums(const std::string &fileName, size_t outSize,
+		      const std::string &optsText,
+		      const std::vector<SeqSums> &sums) {
+  std::ofstream out(fileName.c_str());
+  out << sumsTag << '\t' << outSize << '\t' << optsText << '\n';
+  for (size_t i = 0; i < sums.size(); ++i) {
+    const SeqSums &x = sums[i];
+    out << x.name << '\t' << x.checksum1 << '\t' << x.checksum2 << '\t'
+	<< x.output.beg << '\t' << x.output.end << '\n';
+  }
+  out.close();
+  if (!out) err("can't write file: " + fileName);
 }
 
-static void writeSegJoin(const Seg &s, const Seg &t, long beg, long end) {
-  size_t maxChangedStarts = std::max(s.parts.size(), t.parts.size()) - 1;
-  size_t space = s.line.size() + t.line.size() + 32 * maxChangedStarts;
-  buffer.resize(space);
-  char *bufferEnd = &buffer.back() + 1;
-  char *e = bufferEnd;
-  *--e = '\n';
-  e = segSliceTail(e, t, beg);
-  e = segSliceTail(e, s, beg);
-  e = segSliceHead(e, s, beg, end);
-  std::cout.write(e, bufferEnd - e);
+// Gets the sums for each first-sequence name in either file, in
+// order.  If a name's lines are unchanged in both files, its old
+// output gets reused, else its lines are added to "ranges1" and
+// "ranges2", to be joined.
+static void getSums(const std::vector<SeqBlock> &blocks1,
+		    const std::vector<SeqBlock> &blocks2,
+		    const std::unordered_map<std::string, SeqSums> &oldSums,
+		    std::vector<SeqSums> &sums,
+		    std::vector<ByteRange> &ranges1,
+		    std::vector<ByteRange> &ranges2) {
+  size_t i = 0;
+  size_t j = 0;
+  while (i < blocks1.size() || j < blocks2.size()) {
+    int c = (i == blocks1.size()) ? 1 : (j == blocks2.size()) ? -1
+      : blocks1[i].name.compare(blocks2[j].name);
+    const SeqBlock *b1 = (c <= 0) ? &blocks1[i++] : 0;
+    const SeqBlock *b2 = (c >= 0) ? &blocks2[j++] : 0;
+    SeqSums x;
+    x.name = b1 ? b1->name : b2->name;
+    x.checksum1 = b1 ? b1->checksum : 0;
+    x.checksum2 = b2 ? b2->checksum : 0;
+    x.output.beg = x.output.end = 0;
+    std::unordered_map<std::string, SeqSums>::const_iterator k =
+      oldSums.find(x.name);
+    x.isReused = (k != oldSums.end() && k->second.checksum1 == x.checksum1
+		  && k->second.checksum2 == x.checksum2);
+    if (x.isReused) {
+      x.output = k->second.output;
+    } else {
+      if (b1) ranges1.push_back(b1->range);
+      if (b2) ranges2.push_back(b2->range);
+    }
+    sums.push_back(x);
+  }
 }
 
-static bool isOverlappable(const Seg &s, const Seg &t) {
-  if (s.parts.size() != t.parts.size()) return false;
-  long d = beg0(s) - beg0(t);
-  for (size_t i = 1; i < s.parts.size(); ++i) {
-    if (nameCmp(s, t, i)) return false;
-    if (segBeg(s, i) - segBeg(t, i) != d) return false;
+// Writes the output of an incremental join, and splices in the old
+// output of names that are reused, at their places in name order
+class SplicedOutput : public SegTextOutput {
+public:
+  SplicedOutput(SegOutput &out, std::istream &oldOut,
+		std::vector<SeqSums> &sums)
+    : out(out), oldOut(oldOut), sums(sums), next(0), pos(0),
+      current(0) {}
+
+  void write(const char *beg, size_t size) {
+    StringView name = firstSeqName(beg, beg + size);
+    if (!current || name != StringView(current->name)) {
+      while (next < sums.size() && StringView(sums[next].name) < name)
+	copyOld(sums[next++]);
+      if (next == sums.size() || name != StringView(sums[next].name))
+	err("input not sorted properly");
+      current = &sums[next++];
+      current->output.beg = pos;
+    }
+    out.write(beg, size);
+    pos += size;
+    current->output.end = pos;
   }
-  return true;
+
+  // Writes the rest of the old output, and returns the total size
+  size_t finish() {
+    while (next < sums.size()) copyOld(sums[next++]);
+    return pos;
+  }
+
+private:
+  SegOutput &out;
+  std::istream &oldOut;
+  std::vector<SeqSums> &sums;
+  size_t next;
+  size_t pos;
+  SeqSums *current;
+  std::vector<char> buffer;
+
+  void copyOld(SeqSums &x) {
+    if (!x.isReused) return;
+    size_t size = x.output.end - x.output.beg;
+    oldOut.seekg(x.output.beg);
+    x.output.beg = pos;
+    while (size) {
+      buffer.resize(std::min(size, size_t(1) << 20));
+      if (!oldOut.read(buffer.data(), buffer.size()))
+	err("can't read the old output");
+      out.write(buffer.data(), buffer.size());
+      pos += buffer.size();
+      size -= buffer.size();
+    }
+    x.output.end = pos;
+  }
+};
+
+// Joins the files, writing the output to outName, and reusing the
+// previous output (if any) for names whose input lines are unchanged
+static void segJoinIncremental(const SegJoinOptions &opts,
+			       const SegInputOptions &inOpts,
+			       const char *fileName1, const char *fileName2,
+			       const std::string &outName) {
+  if (isChar(fileName1, '-') || isChar(fileName2, '-'))
+    err("option -u: can't read an input from a pipe");
+  if (isSegBinaryFile(fileName1) || isSegBinaryFile(fileName2))
+    err("option -u: can't read a binary SEG file");
+  std::vector<SeqBlock> blocks1, blocks2;
+  readSeqBlocks(fileName1, blocks1);
+  readSeqBlocks(fileName2, blocks2);
+
+  std::string optsText = optionsText(opts);
+  std::string sumsName = outName + ".sums";
+  std::unordered_map<std::string, SeqSums> oldSums;
+  readSums(sumsName, outName, optsText, oldSums);
+
+  std::vector<SeqSums> sums;
+  std::vector<ByteRange> ranges1, ranges2;
+  getSums(blocks1, blocks2, oldSums, sums, ranges1, ranges2);
+
+  std::string tmpName = outName + ".tmp";
+  std::ifstream oldOut;
+  if (!oldSums.empty()) oldOut.open(outName.c_str(), std::ios::binary);
+  std::ofstream newOut(tmpName.c_str(), std::ios::binary);
+  if (!newOut) err("can't open file: " + tmpName);
+  SegOutput output(newOut);
+  SplicedOutput spliced(output, oldOut, sums);
+  {
+    SegInput in1(fileName1, inOpts, &ranges1);
+    SegInput in2(fileName2, inOpts, &ranges2);
+    SortedSegReader r1(in1.source);
+    SortedSegReader r2(in2.source);
+    SegJoinWriter writer(spliced);
+    segJoin(r1, r2, opts, writer);
+  }
+  size_t outSize = spliced.finish();
+  output.finish();
+  newOut.close();
+  if (!newOut) err("can't write file: " + tmpName);
+
+  std::string tmpSumsName = sumsName + ".tmp";
+  writeSums(tmpSumsName, outSize, optsText, sums);
+  std::remove(sumsName.c_str());
+  if (std::rename(tmpName.c_str(), outName.c_str()) ||
+      std::rename(tmpSumsName.c_str(), sumsName.c_str()))
+    err("can't rename to: " + outName);
 }
 
-static void removeOldSegs(std::vector<Seg> &keptSegs, long ibeg) {
-  size_t end = keptSegs.size();
-  size_t j = 0;
-  for ( ; ; ++j) {
-    if (j == end) return;
-    if (end0(keptSegs[j]) <= ibeg) break;
+// Joins the files, writing the output to outName, with a checkpoint
+// (if the interval has passed) whenever a new query sequence name
+// starts.  If isResume, it carries on from the last checkpoint.
+static void segJoinCheckpointed(const SegJoinOptions &opts,
+				const SegInputOptions &inOpts,
+				const char *fileName1, const char *fileName2,
+				const std::string &outName,
+				double interval, bool isResume) {
+  if (isChar(fileName1, '-') || isChar(fileName2, '-'))
+    err("option -k: can't read an input from a pipe");
+  if (isSegBinaryFile(fileName1) || isSegBinaryFile(fileName2))
+    err("option -k: can't read a binary SEG file");
+  ByteRange x = {0, fileSize(fileName1)};
+  ByteRange y = {0, fileSize(fileName2)};
+  std::ostringstream key;
+  key << optionsText(opts) << '\t' << fileName1 << '\t' << x.end
+      << '\t' << fileName2 << '\t' << y.end;
+  std::vector<size_t> pos;
+  SegCheckpointOutput output(outName, key.str(), interval, isResume, pos);
+  if (pos.empty()) pos.resize(2);
+  if (pos.size() != 2) err("bad file: " + outName + ".ckpt");
+  x.beg = pos[0];
+  y.beg = pos[1];
+  std::vector<ByteRange> ranges1(1, x);
+  std::vector<ByteRange> ranges2(1, y);
+  SegInput in1(fileName1, inOpts, &ranges1);
+  SegInput in2(fileName2, inOpts, &ranges2);
+  SortedSegReader r1(in1.source);
+  SortedSegReader r2(in2.source);
+  SegJoinWriter writer(output);
+  SegJoiner joiner(r1, r2, opts, writer);
+  const SortedSegReader &q = joiner.queryReader();
+  while (true) {
+    bool isMore = joiner.isMore();
+    if (!isMore || (q.isNewSeqName() && output.isDue())) {
+      pos[0] = in1.part.recordBeg();
+      pos[1] = in2.part.recordBeg();
+      output.checkpoint(pos);
+    }
+    if (!isMore) break;
+    joiner.step();
   }
-  for (size_t k = j + 1; k < end; ++k) {
-    Seg &t = keptSegs[k];
-    if (end0(t) > ibeg)
-      moveSeg(t, keptSegs[j++]);
+  output.finish();
+}
+
+// The start of the first line beginning at or after byte "pos"
+static size_t lineStartAtOrAfter(std::istream &in, size_t pos) {
+  if (pos == 0) return 0;
+  in.clear();
+  in.seekg(pos - 1);
+  std::string line;
+  getline(in, line);
+  return pos + line.size();
+}
+
+// Finds the first data line at or after byte "pos" (a line start) and
+// before "end", sets "pos" to its start, and gets its first sequence
+// name and start coordinate
+static bool readSegKey(std::istream &in, size_t &pos, size_t end,
+		       std::string &name, long &beg) {
+  in.clear();
+  in.seekg(pos);
+  std::string line;
+  while (pos < end && getline(in, line)) {
+    if (isDataLine(line.c_str())) {
+      const char *b = line.c_str();
+      const char *e = b + line.size();
+      long length;
+      const char *n;
+      const char *c = readSegWord(readSegLong(b, e, length), e, n);
+      if (!readSegLong(c, e, beg)) err("bad SEG line: " + line);
+      name.assign(n, c);
+      return true;
+    }
+    pos += line.size() + 1;
   }
-  keptSegs.resize(j);
+  return false;
 }
 
-static int newNameCmp(const Seg &s, const SortedSegReader &r) {
-  return r.isMore() ? nameCmp(s, r.get(), 0) : -1;
+static bool isKeyLess(const std::string &xName, long xBeg,
+		      const std::string &yName, long yBeg) {
+  int c = xName.compare(yName);
+  return c ? c < 0 : xBeg < yBeg;
 }
 
-static void skipOneSequence(SortedSegReader &r) {
-  do {
-    r.next();
-  } while (!r.isNewSeqName());
+// The start of the first data line, in a sorted SEG file of this
+// size, whose first name and start are not less than (name, beg)
+static size_t seekSegKey(std::istream &in, size_t size,
+			 const std::string &name, long beg) {
+  size_t lo = 0;  // lines starting before this are less
+  size_t hi = size;  // lines starting here or after aren't less
+  std::string n;
+  long b;
+  while (true) {
+    size_t p = std::min(lineStartAtOrAfter(in, lo + (hi - lo) / 2), size);
+    if (p >= hi) break;
+    size_t q = p;
+    if (readSegKey(in, q, hi, n, b) && isKeyLess(n, b, name, beg))
+      lo = std::min(lineStartAtOrAfter(in, q + 1), size);
+    else
+      hi = p;
+  }
+  while (readSegKey(in, lo, size, n, b) && isKeyLess(n, b, name, beg))
+    lo = std::min(lineStartAtOrAfter(in, lo + 1), size);
+  return std::min(lo, size);
 }
 
-static void updateKeptSegs(std::vector<Seg> &keptSegs, SortedSegReader &r,
-			   const SortedSegReader &q) {
-  const Seg &s = q.get();
-  long ibeg = beg0(s);
-  long iend = end0(s);
-
-  if (q.isNewSeqName()) {
-    keptSegs.clear();
-    if (r.isNewSeqName()) {
-      while (true) {
-	int c = newNameCmp(s, r);
-	if (c < 0) return;
-	if (c == 0) break;
-	skipOneSequence(r);
-      }
-    } else {
-      while (true) {
-	skipOneSequence(r);
-	int c = newNameCmp(s, r);
-	if (c < 0) return;
-	if (c == 0) break;
+// The first name and start of the first query in a range, and the
+// start of the first record of the other file that isn't less
+struct RangeKey {
+  std::string name;
+  long beg;
+  size_t pos;
+};
+
+static bool isKeyLess(const RangeKey &x, const RangeKey &y) {
+  return isKeyLess(x.name, x.beg, y.name, y.beg);
+}
+
+// A line of the other file, before some ranges' start positions, that
+// might overlap queries in those ranges
+struct WindowLine {
+  ByteRange line;
+  size_t endRange;  // it's needed by ranges up to just before this
+};
+
+// Reads slice k of the other file, from range k-1's start position to
+// range k's, checking that it's sorted, and gets the lines that
+// overlap the first query of range k or later
+static void scanSlice(const char *fileName, const std::vector<RangeKey> &keys,
+		      size_t k, std::vector<WindowLine> &lines,
+		      std::exception_ptr &error) {
+  try {
+    std::ifstream in(fileName);
+    if (!in) err("can't open file: " + std::string(fileName));
+    size_t end = keys[k].pos;
+    std::vector<ByteRange> ranges(1);
+    ranges[0].beg = keys[k - 1].pos;
+    ranges[0].end = fileSize(fileName);
+    // read one record past the end, to check its order too
+    SegRangesSource source(in, ranges);
+    SortedSegReader r(source);
+    while (r.isMore() && source.recordBeg() < end) {
+      const Seg &s = r.get();
+      StringView name = seqName(s, 0);
+      size_t t = k;
+      while (t < keys.size() && name.compare(StringView(keys[t].name)) == 0 &&
+	     keys[t].beg < end0(s)) ++t;
+      size_t beg = source.recordBeg();
+      r.next();
+      if (t > k) {
+	WindowLine w = {{beg, source.recordBeg()}, t};
+	lines.push_back(w);
       }
     }
-  } else {
-    removeOldSegs(keptSegs, ibeg);
-    if (r.isNewSeqName()) {
-      int c = newNameCmp(s, r);
-      if (c < 0) return;
-      assert(c == 0);
+  } catch (...) {
+    error = std::current_exception();
+  }
+}
+
+// Gets the byte ranges of the other file to read for range t: the
+// lines before its start position that overlap its first query, and
+// everything after
+static void getWindow(const std::vector<RangeKey> &keys, size_t rSize,
+		      const std::vector<std::vector<WindowLine> > &slices,
+		      size_t t, std::vector<ByteRange> &ranges) {
+  for (size_t k = 1; k <= t; ++k) {
+    for (size_t i = 0; i < slices[k].size(); ++i) {
+      const WindowLine &w = slices[k][i];
+      if (w.endRange <= t) continue;
+      if (!ranges.empty() && ranges.back().end == w.line.beg)
+	ranges.back().end = w.line.end;
+      else
+	ranges.push_back(w.line);
     }
   }
+  ByteRange rest = {keys[t].pos, rSize};
+  if (!ranges.empty() && ranges.back().end == rest.beg)
+    ranges.back().end = rest.end;
+  else
+    ranges.push_back(rest);
+}
 
-  do {
-    const Seg &t = r.get();
-    long jbeg = beg0(t);
-    if (jbeg >= iend) break;
-    long jend = end0(t);
-    if (jend > ibeg) keptSegs.push_back(t);
-    r.next();
-  } while (!r.isNewSeqName());
+// Joins some byte ranges of the query file with some byte ranges of
+// the other file
+static void joinRanges(const SegJoinOptions &opts,
+		       const SegInputOptions &inOpts,
+		       const char *qName, const std::vector<ByteRange> &qRanges,
+		       const char *rName, const std::vector<ByteRange> &rRanges,
+		       SegJoinSink &out, std::exception_ptr &error) {
+  try {
+    SegInput q(qName, inOpts, &qRanges);
+    SegInput r(rName, inOpts, &rRanges);
+    SortedSegReader qReader(q.source);
+    SortedSegReader rReader(r.source);
+    if (isQueryFile2(opts)) segJoin(rReader, qReader, opts, out);
+    else segJoin(qReader, rReader, opts, out);
+  } catch (...) {
+    error = std::current_exception();
+  }
 }
 
-static void writeUnjoinableSegs(SortedSegReader &querys, SortedSegReader &refs,
-				bool isComplete, bool isAll) {
-  std::vector<Seg> keptSegs;
-  for ( ; querys.isMore(); querys.next()) {
-    const Seg &s = querys.get();
-    long ibeg = beg0(s);
-    long iend = end0(s);
-    updateKeptSegs(keptSegs, refs, querys);
-    for (size_t j = 0; j < keptSegs.size(); ++j) {
-      const Seg &t = keptSegs[j];
-      long jbeg = beg0(t);
-      if (jbeg >= iend) break;
-      if (isAll && !isOverlappable(s, t)) continue;
-      if (isComplete) {
-	ibeg = iend;
-	break;
+// Joins two files in several threads.  The query file (the one whose
+// records get written) is split into byte ranges at line starts.
+// Each thread joins one range of queries with the other file, read
+// from where the range's first query would be, plus any earlier lines
+// that overlap it.  Those are found first, by several threads each
+// reading the slice of the other file between two ranges' starts.  So
+// each query is joined exactly as it would be by one thread, and the
+// outputs, concatenated in order, are the same.  If a slice isn't
+// sorted or has a bad line, the files are joined by one thread
+// instead, to get the same error.
+static void segJoinThreaded(const SegJoinOptions &opts,
+			    const SegInputOptions &inOpts,
+			    const SegOutputOptions &outOpts,
+			    const SegSummaryOptions &sumOpts,
+			    const char *fileName1, const char *fileName2,
+			    size_t numOfThreads) {
+  if (isChar(fileName1, '-') || isChar(fileName2, '-'))
+    err("option -t: can't read from a pipe");
+  if (isSegBinaryFile(fileName1) || isSegBinaryFile(fileName2))
+    err("option -t: can't read a binary SEG file");
+  const char *qName = isQueryFile2(opts) ? fileName2 : fileName1;
+  const char *rName = isQueryFile2(opts) ? fileName1 : fileName2;
+  size_t qSize = fileSize(qName);
+  size_t rSize = fileSize(rName);
+
+  std::ifstream qIn(qName);
+  std::ifstream rIn(rName);
+  if (!qIn) err("can't open file: " + std::string(qName));
+  if (!rIn) err("can't open file: " + std::string(rName));
+  std::vector<std::vector<ByteRange> > qRanges(numOfThreads);
+  std::vector<RangeKey> keys(numOfThreads);
+  keys[0].beg = 0;
+  keys[0].pos = 0;
+  size_t qBeg = 0;
+  for (size_t t = 0; t < numOfThreads; ++t) {
+    size_t qEnd = std::min(lineStartAtOrAfter(qIn, qSize * (t + 1) /
+					      numOfThreads), qSize);
+    ByteRange q = {qBeg, qEnd};
+    qRanges[t].push_back(q);
+    RangeKey &k = keys[t];
+    size_t p = qBeg;
+    if (readSegKey(qIn, p, qEnd, k.name, k.beg)) {
+      if (t == 0) {
+	k.pos = 0;
+      } else {
+	if (!isKeyLess(k, keys[t - 1]))
+	  k.pos = seekSegKey(rIn, rSize, k.name, k.beg);
+	if (isKeyLess(k, keys[t - 1]) || k.pos < keys[t - 1].pos) {
+	  // one of the inputs isn't sorted
+	  segJoin(opts, inOpts, outOpts, sumOpts, fileName1, fileName2);
+	  return;
+	}
       }
-      long jend = end0(t);
-      if (jbeg > ibeg) writeSegSlice(s, ibeg, jbeg);
-      if (jend > ibeg) ibeg = jend;
+    } else if (t > 0) {
+      k = keys[t - 1];
     }
-    if (iend > ibeg) writeSegSlice(s, ibeg, iend);
+    qBeg = qEnd;
   }
-}
 
-static void writeOverlappingSegs(SortedSegReader &querys,
-				 SortedSegReader &refs,
-				 Fraction minFrac, bool isAll) {
-  std::vector<Seg> keptSegs;
-  for ( ; querys.isMore(); querys.next()) {
-    const Seg &s = querys.get();
-    long ibeg = beg0(s);
-    long iend = end0(s);
-    long overlap = 0;
-    long kbeg = ibeg;
-    updateKeptSegs(keptSegs, refs, querys);
-    for (size_t j = 0; j < keptSegs.size(); ++j) {
-      const Seg &t = keptSegs[j];
-      long jbeg = beg0(t);
-      long jend = end0(t);
-      if (jbeg >= iend) break;
-      if (jend <= kbeg) continue;
-      if (isAll && !isOverlappable(s, t)) continue;
-      long end = std::min(iend, jend);
-      overlap += end - std::max(jbeg, kbeg);
-      kbeg = end;
-    }
-    if (overlap * minFrac.denom >= (iend - ibeg) * minFrac.numer) {
-      writeSegSlice(s, ibeg, iend);
+  std::vector<std::vector<WindowLine> > slices(numOfThreads);
+  std::vector<std::exception_ptr> errors(numOfThreads);
+  std::vector<std::thread> threads(numOfThreads);
+  for (size_t k = 1; k < numOfThreads; ++k)
+    threads[k] = std::thread(scanSlice, rName, std::cref(keys), k,
+			     std::ref(slices[k]), std::ref(errors[k]));
+  for (size_t k = 1; k < numOfThreads; ++k) threads[k].join();
+  for (size_t k = 1; k < numOfThreads; ++k) {
+    if (errors[k]) {
+      segJoin(opts, inOpts, outOpts, sumOpts, fileName1, fileName2);
+      return;
     }
   }
-}
 
-static void writeJoinedSegs(SortedSegReader &r1, SortedSegReader &r2,
-			    bool isComplete1, bool isComplete2, bool isAll) {
-  std::vector<Seg> keptSegs;
-  for ( ; r1.isMore(); r1.next()) {
-    const Seg &s = r1.get();
-    long ibeg = beg0(s);
-    long iend = end0(s);
-    updateKeptSegs(keptSegs, r2, r1);
-    for (size_t j = 0; j < keptSegs.size(); ++j) {
-      const Seg &t = keptSegs[j];
-      long jbeg = beg0(t);
-      if (jbeg >= iend) break;
-      if (isAll && !isOverlappable(s, t)) continue;
-      long jend = end0(t);
-      if (isComplete1 && (ibeg < jbeg || iend > jend)) continue;
-      if (isComplete2 && (jbeg < ibeg || jend > iend)) continue;
-      long beg = std::max(ibeg, jbeg);
-      long end = std::min(iend, jend);
-      if (isAll) writeSegSlice(s, beg, end);
-      else writeSegJoin(s, t, beg, end);
+  std::vector<std::vector<ByteRange> > rRanges(numOfThreads);
+  for (size_t t = 0; t < numOfThreads; ++t)
+    if (qRanges[t][0].beg < qRanges[t][0].end)
+      getWindow(keys, rSize, slices, t, rRanges[t]);
+
+  std::vector<std::unique_ptr<SegTempOutput> > outputs(numOfThreads);
+  std::vector<std::unique_ptr<SegJoinSink> > sinks(numOfThreads);
+  for (size_t t = 0; t < numOfThreads; ++t) {
+    if (sumOpts.segmentNum) {
+      sinks[t].reset(new SegJoinSummary(sumOpts.segmentNum));
+    } else {
+      outputs[t].reset(new SegTempOutput);
+      sinks[t].reset(new SegJoinWriter(*outputs[t]));
     }
+    threads[t] = std::thread(joinRanges, std::cref(opts), std::cref(inOpts),
+			     qName, std::cref(qRanges[t]),
+			     rName, std::cref(rRanges[t]),
+			     std::ref(*sinks[t]), std::ref(errors[t]));
   }
-}
+  for (size_t t = 0; t < numOfThreads; ++t) threads[t].join();
 
-static void segJoin(const SegJoinOptions &opts) {
-  SortedSegReader r1(opts.fileName1);
-  SortedSegReader r2(opts.fileName2);
-  if (opts.unjoinableFileNumber == 1)
-    writeUnjoinableSegs(r1, r2, opts.isComplete1, opts.isJoinOnAllSegments);
-  else if (opts.unjoinableFileNumber == 2)
-    writeUnjoinableSegs(r2, r1, opts.isComplete2, opts.isJoinOnAllSegments);
-  else if (opts.overlappingFileNumber == 1)
-    writeOverlappingSegs(r1, r2, opts.minOverlap, opts.isJoinOnAllSegments);
-  else if (opts.overlappingFileNumber == 2)
-    writeOverlappingSegs(r2, r1, opts.minOverlap, opts.isJoinOnAllSegments);
-  else
-    writeJoinedSegs(r1, r2, opts.isComplete1, opts.isComplete2,
-		    opts.isJoinOnAllSegments);
+  if (sumOpts.segmentNum) {
+    for (size_t t = 0; t < numOfThreads; ++t)
+      if (errors[t]) std::rethrow_exception(errors[t]);
+    SegJoinSummary summary(sumOpts.segmentNum);
+    for (size_t t = 0; t < numOfThreads; ++t)
+      summary.add(static_cast<SegJoinSummary &>(*sinks[t]));
+    writeSummary(summary, sumOpts.isPerName);
+    return;
+  }
+
+  // like one thread, write the output up to the first error
+  SegDestination output(outOpts, inOpts.isPipelined);
+  for (size_t t = 0; t < numOfThreads; ++t) {
+    outputs[t]->copyTo(output.get());
+    if (errors[t]) std::rethrow_exception(errors[t]);
+  }
+  output.finish();
 }
 
 static void run(int argc, char **argv) {
@@ -466,11 +965,32 @@ static void run(int argc, char **argv) {
   opts.overlappingFileNumber = 0;
   opts.unjoinableFileNumber = 0;
   opts.isJoinOnAllSegments = false;
+  opts.isCoverage = false;
+  opts.maxMemory = 0;
+  SegInputOptions inOpts;
+  inOpts.isPipelined = false;
+  inOpts.maxShift = 0;
+  SegOutputOptions outOpts;
+  outOpts.shardPrefix = 0;
+  outOpts.numOfShards = 0;
+  const char *incrementalOutName = 0;
+  const char *checkpointedOutName = 0;
+  unsigned checkpointInterval = defaultCheckpointInterval;
+  bool isCheckpointInterval = false;
+  bool isResume = false;
+  const char *fanOutSuffix = 0;
+  bool isServer = false;
+  size_t numOfThreads = 1;
+  SegSummaryOptions sumOpts;
+  sumOpts.segmentNum = 0;
+  sumOpts.isPerName = false;
   opts.minOverlap.numer = 0;
   opts.minOverlap.denom = 0;
 
   std::string help = "\
 Usage: " + std::string(argv[0]) + " [options] file1.seg file2.seg\n\
+   or: " + std::string(argv[0]) + " -m SUFFIX [options] file1.seg... file2.seg\n\
+   or: " + std::string(argv[0]) + " -q [options] file2.seg...\n\
 \n\
 Read two SEG files, and write their JOIN.\n\
 \n\
@@ -483,12 +1003,44 @@ Options:\n\
                  covered by file 1\n\
   -x PERCENT     write each record of file 2, if at most PERCENT of it is\n\
                  covered by file 1\n\
+  -l             write each record of file 2 (or of -f FILENUM), with an extra\n\
+                 column: how many of its bases are covered by the other file\n\
   -v FILENUM     only write unjoinable parts of file FILENUM\n\
   -w             join on whole segment-tuples, not just first segments\n\
+  -p             pipelined: read the inputs, and write the output, in\n\
+                 background threads\n\
+  -r K           accept inputs whose records are out of order by at most K\n\
+                 records\n\
+  -o PREFIX      write the output into files PREFIXname.seg, one per first\n\
+                 sequence name\n\
+  -s N           with -o: write N files PREFIX0.seg, PREFIX1.seg, etc., and\n\
+                 choose the file by hashing the first sequence name\n\
+  -u FILE        incremental: write the output to FILE, reusing the previous\n\
+                 FILE's output for sequences whose inputs haven't changed\n\
+  -k FILE        write the output to FILE, with checkpoints in FILE.ckpt, so\n\
+                 that an interrupted run can be resumed\n\
+  -K SECONDS     with -k: time between checkpoints (default=" +
+    std::to_string(defaultCheckpointInterval) + ")\n\
+  -R             with -k: resume from the last checkpoint\n\
+  -m SUFFIX      join each file 1 with file 2, reading file 2 only once, and\n\
+                 write the output into files named file1.segSUFFIX\n\
+  -d N           instead of the output records, write how many there are,\n\
+                 their total length, and the number of distinct sequence\n\
+                 names in their Nth segment\n\
+  -g N           for each distinct sequence name in the Nth segment of the\n\
+                 output records, write the name, how many records, and\n\
+                 their total length\n\
+  -t THREADS     number of parallel threads, each joining a range of records\n\
+  -M SIZE        keep at most about this much memory of file-2 records that\n\
+                 might overlap upcoming records, and put any more in\n\
+                 temporary files (e.g. 500M, 2G), which are read again for\n\
+                 each file-1 record, so a deep pile of records is slow\n\
+  -q             server: load the files, then read join requests from\n\
+                 standard input (see README)\n\
   -V, --version  show version number and exit\n\
 ";
 
-  const char sOpts[] = "hc:f:n:x:v:wV";
+  const char sOpts[] = "hc:f:n:x:lv:wd:g:pr:o:s:u:k:K:Rm:qt:M:V";
 
   static struct option lOpts[] = {
     { "help",    no_argument, 0, 'h' },
@@ -503,36 +1055,84 @@ Options:\n\
       std::cout << help;
       return;
     case 'c':
-      if      (isChar(optarg, '1')) opts.isComplete1 = true;
-      else if (isChar(optarg, '2')) opts.isComplete2 = true;
-      else err("option -c: should be 1 or 2");
-      break;
     case 'f':
-      if (opts.overlappingFileNumber) err("option -f: cannot use twice");
-      else if (isChar(optarg, '1')) opts.overlappingFileNumber = 1;
-      else if (isChar(optarg, '2')) opts.overlappingFileNumber = 2;
-      else err("option -f: should be 1 or 2");
-      break;
     case 'n':
-      if (opts.minOverlap.denom) err("option -n/-x: cannot use twice");
-      if (!readFraction(optarg, opts.minOverlap))
-	err("option -n: bad value");
-      break;
     case 'x':
-      if (opts.minOverlap.denom) err("option -n/-x: cannot use twice");
-      if (!readFraction(optarg, opts.minOverlap))
-	err("option -x: bad value");
-      opts.minOverlap.numer *= -1;
-      opts.minOverlap.denom *= -1;
-      break;
+    case 'l':
     case 'v':
-      if (opts.unjoinableFileNumber) err("option -v: cannot use twice");
-      else if (isChar(optarg, '1')) opts.unjoinableFileNumber = 1;
-      else if (isChar(optarg, '2')) opts.unjoinableFileNumber = 2;
-      else err("option -v: should be 1 or 2");
-      break;
     case 'w':
-      opts.isJoinOnAllSegments = true;
+      setJoinOption(opts, c, optarg);
+      break;
+    case 'd':
+    case 'g':
+      {
+	if (sumOpts.segmentNum) err("option -d/-g: cannot use twice");
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned n;
+	sv >> n;
+	if (!sv || n < 1) err(std::string("option -") + char(c) + ": bad value");
+	sumOpts.segmentNum = n;
+	sumOpts.isPerName = (c == 'g');
+      }
+      break;
+    case 'p':
+      inOpts.isPipelined = true;
+      break;
+    case 'M':
+      if (!readByteSize(optarg, opts.maxMemory)) err("option -M: bad value");
+      break;
+    case 'r':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned k;
+	sv >> k;
+	if (!sv) err("option -r: bad value");
+	inOpts.maxShift = k;
+      }
+      break;
+    case 'o':
+      outOpts.shardPrefix = optarg;
+      break;
+    case 's':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned n;
+	sv >> n;
+	if (!sv || n < 1) err("option -s: bad value");
+	outOpts.numOfShards = n;
+      }
+      break;
+    case 'u':
+      incrementalOutName = optarg;
+      break;
+    case 'k':
+      checkpointedOutName = optarg;
+      break;
+    case 'K':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	sv >> checkpointInterval;
+	if (!sv) err("option -K: bad value");
+	isCheckpointInterval = true;
+      }
+      break;
+    case 'R':
+      isResume = true;
+      break;
+    case 'm':
+      fanOutSuffix = optarg;
+      break;
+    case 'q':
+      isServer = true;
+      break;
+    case 't':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned n;
+	sv >> n;
+	if (!sv || n < 1) err("option -t: bad value");
+	numOfThreads = n;
+      }
       break;
     case 'V':
       std::cout << "seg-join "
@@ -545,27 +1145,68 @@ Options:\n\
     }
   }
 
-  if (opts.minOverlap.denom && !opts.overlappingFileNumber) {
-    opts.overlappingFileNumber = 2;
-  }
+  SegJoinOptions defaults = opts;
+  finishJoinOptions(opts);
 
-  if (opts.overlappingFileNumber && !opts.minOverlap.denom) {
-    opts.minOverlap.numer = 1;
-    unsigned long x = -1;
-    opts.minOverlap.denom = x / 2 + 1;
-  }
+  if (outOpts.numOfShards && !outOpts.shardPrefix)
+    err("option -s needs option -o");
+
+  if (incrementalOutName && outOpts.shardPrefix)
+    err("can't combine option -u with option -o");
+
+  if (fanOutSuffix && (incrementalOutName || outOpts.shardPrefix))
+    err("can't combine option -m with option -o or -u");
+
+  if (isServer && (fanOutSuffix || incrementalOutName || outOpts.shardPrefix))
+    err("can't combine option -q with option -m, -o or -u");
+
+  if (sumOpts.segmentNum && (isServer || fanOutSuffix || incrementalOutName ||
+			     outOpts.shardPrefix))
+    err("can't combine option -d or -g with option -m, -o, -q or -u");
+
+  if (numOfThreads > 1 &&
+      (isServer || fanOutSuffix || incrementalOutName || inOpts.maxShift))
+    err("can't combine option -t with option -m, -q, -r or -u");
 
-  if (optind != argc - 2) {
+  if ((isCheckpointInterval || isResume) && !checkpointedOutName)
+    err("option -K or -R needs option -k");
+
+  if (checkpointedOutName &&
+      (isServer || fanOutSuffix || incrementalOutName || outOpts.shardPrefix ||
+       sumOpts.segmentNum || numOfThreads > 1 || inOpts.isPipelined ||
+       inOpts.maxShift))
+    err("can't combine option -k with option -d, -g, -m, -o, -p, -q, -r, -t "
+	"or -u");
+
+  if (isServer ? optind > argc - 1
+      : fanOutSuffix ? optind > argc - 2 : optind != argc - 2) {
     std::cerr << help;
     err("");
   }
 
-  opts.fileName1 = argv[argc - 2];
-  opts.fileName2 = argv[argc - 1];
-
   std::ios_base::sync_with_stdio(false);  // makes it faster!
 
-  segJoin(opts);
+  if (isServer)
+    segJoinServer(defaults, inOpts, argv + optind, argc - optind);
+  else if (fanOutSuffix)
+    segJoinFanOut(opts, inOpts, argv + optind, argc - optind, fanOutSuffix);
+  else if (incrementalOutName)
+    segJoinIncremental(opts, inOpts, argv[argc - 2], argv[argc - 1],
+		       incrementalOutName);
+  else if (checkpointedOutName)
+    segJoinCheckpointed(opts, inOpts, argv[argc - 2], argv[argc - 1],
+			checkpointedOutName, checkpointInterval, isResume);
+  else if (numOfThreads > 1)
+    segJoinThreaded(opts, inOpts, outOpts, sumOpts,
+		    argv[argc - 2], argv[argc - 1], numOfThreads);
+  else
+    segJoin(opts, inOpts, outOpts, sumOpts, argv[argc - 2], argv[argc - 1]);
+
+  if (opts.maxMemory) {
+    const SpillStats &stats = spillStats();
+    std::cerr << argv[0] << ": spilled " << stats.records
+	      << " records to temporary files (" << stats.bytes << " bytes)\n";
+  }
 }
 
 int main(int argc, char **argv) {
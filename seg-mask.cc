@@ -0,0 +1,234 @@
+// Author: Martin C. Frith 2017
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Mask segments in sequences: write the segments in lowercase (or as
+// one letter), and the rest in uppercase (or unchanged).  The
+// sequences can be FASTA, FASTQ, or .2bit.
+
+#include "mcf_seg_join.hh"
+#include "mcf_seq_io.hh"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace mcf;
+
+struct SegMaskOptions {
+  char maskLetter;  // if 0, mask by lowercasing
+  bool isKeepCase;
+};
+
+struct Interval {
+  size_t beg;
+  size_t end;
+};
+
+static bool isIntervalLess(const Interval &x, const Interval &y) {
+  return x.beg != y.beg ? x.beg < y.beg : x.end < y.end;
+}
+
+typedef std::unordered_map<std::string, std::vector<Interval> > Intervals;
+
+// Gets the first segment of each segment-tuple, on the forward strand
+static void readIntervals(const char *fileName, Intervals &intervals) {
+  std::ifstream ifs;
+  std::istream &in = openIn(fileName, ifs);
+  LineReader reader(in);
+  RecentNames recent;
+  Seg s;
+  StringView line;
+  while (getDataLine(reader, line)) {
+    parseSeg(line, recent, s);
+    long beg = beg0(s);
+    long end = end0(s);
+    if (beg < 0) {
+      beg = -beg;
+      end = -end;
+      std::swap(beg, end);
+    }
+    if (beg < 0 || end < beg) err("bad SEG line: " + line);
+    StringView n = seqName(s, 0);
+    Interval i = {static_cast<size_t>(beg), static_cast<size_t>(end)};
+    intervals[std::string(n.begin(), n.end())].push_back(i);
+  }
+}
+
+// Sorts the intervals, and merges overlapping or touching ones
+static void mergeIntervals(std::vector<Interval> &v) {
+  std::sort(v.begin(), v.end(), isIntervalLess);
+  size_t j = 0;
+  Interval m = {0, 0};
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (v[i].beg > m.end) {
+      if (m.end) v[j++] = m;
+      m = v[i];
+    } else {
+      m.end = std::max(m.end, v[i].end);
+    }
+  }
+  if (m.end) v[j++] = m;
+  v.resize(j);
+}
+
+inline char upperCase(char c) {
+  return (c >= 'a' && c <= 'z') ? c - 32 : c;
+}
+
+inline char lowerCase(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+static void maskSeq(const char *prog, const SegMaskOptions &opts,
+		    const std::vector<Interval> &intervals, std::string &seq) {
+  size_t seqLength = seq.size();
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    size_t beg = intervals[i].beg;
+    size_t end = intervals[i].end;
+    if (end > seqLength) {
+      std::cerr << prog << ": warning: coordinate " << end
+		<< " exceeds sequence length " << seqLength << '\n';
+      end = seqLength;
+      beg = std::min(beg, seqLength);
+    }
+    for (size_t j = beg; j < end; ++j)
+      seq[j] = opts.maskLetter ? opts.maskLetter : lowerCase(seq[j]);
+  }
+}
+
+static void writeWrapped(SegTextOutput &out, const std::string &seq) {
+  const size_t lineLength = 50;
+  for (size_t i = 0; i < seq.size(); i += lineLength) {
+    out.write(seq.data() + i, std::min(lineLength, seq.size() - i));
+    out.write("\n", 1);
+  }
+}
+
+// Masks one sequence record, and writes it
+static void writeMasked(SegTextOutput &out, const char *prog,
+			const SegMaskOptions &opts, const Intervals &intervals,
+			StringView name, SeqRecord &r) {
+  if (!opts.isKeepCase)
+    for (size_t i = 0; i < r.seq.size(); ++i) r.seq[i] = upperCase(r.seq[i]);
+  Intervals::const_iterator f =
+    intervals.find(std::string(name.begin(), name.end()));
+  if (f != intervals.end()) maskSeq(prog, opts, f->second, r.seq);
+  out.write(r.header.data(), r.header.size());
+  out.write("\n", 1);
+  if (r.header2.empty()) {
+    writeWrapped(out, r.seq);
+  } else {
+    out.write(r.seq.data(), r.seq.size());
+    out.write("\n", 1);
+    out.write(r.header2.data(), r.header2.size());
+    out.write("\n", 1);
+    out.write(r.qual.data(), r.qual.size());
+    out.write("\n", 1);
+  }
+}
+
+static void segMask(const char *prog, const SegMaskOptions &opts,
+		    const char *segFileName, const char *seqFileName) {
+  Intervals intervals;
+  readIntervals(segFileName, intervals);
+  for (Intervals::iterator i = intervals.begin(); i != intervals.end(); ++i)
+    mergeIntervals(i->second);
+
+  SegOutput output(std::cout);
+  SeqRecord r;
+  if (isTwoBitFile(seqFileName)) {
+    TwoBitFile file(seqFileName);
+    TwoBitSequence seq;
+    for (size_t i = 0; i < file.numOfSequences(); ++i) {
+      file.get(i, seq);
+      r.header = ">" + seq.name;
+      r.seq.resize(seq.length);
+      seq.get(0, seq.length, opts.isKeepCase, &r.seq[0]);
+      writeMasked(output, prog, opts, intervals, seq.name, r);
+    }
+  } else {
+    std::ifstream ifs;
+    SeqReader reader(openIn(seqFileName, ifs));
+    while (reader.read(r))
+      writeMasked(output, prog, opts, intervals, seqRecordName(r), r);
+  }
+  output.finish();
+}
+
+static void run(int argc, char **argv) {
+  SegMaskOptions opts;
+  opts.maskLetter = 0;
+  opts.isKeepCase = false;
+
+  std::string prog = argv[0];
+  std::string help = "\
+Usage: " + prog + " [options] seg-file fasta-or-fastq-or-2bit-file\n\
+\n\
+Mask segments in sequences.\n\
+\n\
+Options:\n\
+  -h, --help     show this help message and exit\n\
+  -V, --version  show version number and exit\n\
+  -x X           letter to use for masking, instead of lowercase\n\
+  -c             preserve uppercase/lowercase in non-masked regions\n\
+";
+
+  const char sOpts[] = "hx:cV";
+
+  static struct option lOpts[] = {
+    { "help",    no_argument, 0, 'h' },
+    { "version", no_argument, 0, 'V' },
+    { 0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, sOpts, lOpts, &c)) != -1) {
+    switch (c) {
+    case 'h':
+      std::cout << help;
+      return;
+    case 'x':
+      if (!optarg[0] || optarg[1]) err("option -x: should be one letter");
+      opts.maskLetter = optarg[0];
+      break;
+    case 'c':
+      opts.isKeepCase = true;
+      break;
+    case 'V':
+      std::cout << "seg-mask "
+#include "version.hh"
+        "\n";
+      return;
+    case '?':
+      std::cerr << help;
+      err("");
+    }
+  }
+
+  if (argc - optind != 2) {
+    std::cerr << help;
+    err("");
+  }
+
+  std::ios_base::sync_with_stdio(false);  // makes it faster!
+
+  segMask(argv[0], opts, argv[optind], argv[optind + 1]);
+}
+
+int main(int argc, char **argv) {
+  try {
+    run(argc, argv);
+    if (!std::cout.flush()) err("write error");
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    const char *s = e.what();
+    if (*s) std::cerr << argv[0] << ": " << s << '\n';
+    return EXIT_FAILURE;
+  }
+}
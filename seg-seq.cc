@@ -0,0 +1,224 @@
+// Author: Martin C. Frith 2021
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Get segments of sequences, reverse-complemented if they're on the
+// reverse strand.  The sequences can be FASTA, FASTQ, or .2bit: from
+// .2bit, just the needed parts are decoded.
+
+#include "mcf_seg_join.hh"
+#include "mcf_seq_io.hh"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace mcf;
+
+// A range of a sequence, from beg to end: if beg > end, it's the
+// reverse strand
+struct SeqRange {
+  size_t beg;
+  size_t end;
+};
+
+typedef std::unordered_map<std::string, std::vector<SeqRange> > SeqRanges;
+
+// Gets the Nth segment of each segment-tuple with positive length
+static void readSeqRanges(const char *fileName, size_t segmentNum,
+			  SeqRanges &ranges) {
+  std::ifstream ifs;
+  std::istream &in = openIn(fileName, ifs);
+  LineReader reader(in);
+  RecentNames recent;
+  Seg s;
+  while (readSeg(reader, recent, s)) {
+    long length = end0(s) - beg0(s);
+    if (length <= 0) continue;
+    if (segmentNum > s.parts.size())
+      err("there's no segment " + std::to_string(segmentNum) +
+	  " in the input");
+    StringView n = seqName(s, segmentNum - 1);
+    long beg = segBeg(s, segmentNum - 1);
+    long end = beg + length;
+    SeqRange r = {static_cast<size_t>(std::labs(beg)),
+		  static_cast<size_t>(std::labs(end))};
+    ranges[std::string(n.begin(), n.end())].push_back(r);
+  }
+}
+
+struct Complement {
+  char table[256];
+
+  Complement() {
+    for (int i = 0; i < 256; ++i) table[i] = i;
+    const char x[] = "ACGTRYKMBDHVUacgtrykmbdhvu";
+    const char y[] = "TGCAYRMKVHDBAtgcayrmkvhdba";
+    for (size_t i = 0; x[i]; ++i) table[static_cast<unsigned char>(x[i])] = y[i];
+  }
+};
+
+// Gets letters from a FASTA or FASTQ sequence
+struct TextLetters {
+  const std::string &seq;
+
+  void get(size_t beg, size_t end, char *out) const {
+    std::memcpy(out, seq.data() + beg, end - beg);
+  }
+};
+
+// Gets letters from a .2bit sequence, with its masking as lowercase
+struct TwoBitSeqLetters {
+  const TwoBitSequence &seq;
+
+  void get(size_t beg, size_t end, char *out) const {
+    seq.get(beg, end, true, out);
+  }
+};
+
+// Writes the ranges of one sequence, in FASTA format
+template<typename Letters>
+void writeRanges(SegTextOutput &out, StringView name, size_t seqLength,
+		 const std::vector<SeqRange> &ranges, const Letters &letters,
+		 std::string &text) {
+  static const Complement complement;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const SeqRange &r = ranges[i];
+    text = ">" + name + ":" + std::to_string(r.beg) + "-" +
+      std::to_string(r.end) + "\n";
+    size_t end = std::min(std::max(r.beg, r.end), seqLength);
+    size_t beg = std::min(std::min(r.beg, r.end), end);
+    size_t textBeg = text.size();
+    text.resize(textBeg + (end - beg));
+    letters.get(beg, end, &text[textBeg]);
+    if (r.beg > r.end) {
+      std::reverse(text.begin() + textBeg, text.end());
+      for (size_t j = textBeg; j < text.size(); ++j)
+	text[j] = complement.table[static_cast<unsigned char>(text[j])];
+    }
+    text.push_back('\n');
+    out.write(text.data(), text.size());
+  }
+}
+
+static void writeTwoBitRanges(SegTextOutput &out, const SeqRanges &ranges,
+			      const char *fileName) {
+  TwoBitFile file(fileName);
+  TwoBitSequence seq;
+  TwoBitSeqLetters letters = {seq};
+  std::string name, text;
+  for (size_t i = 0; i < file.numOfSequences(); ++i) {
+    StringView n = file.name(i);
+    name.assign(n.begin(), n.end());
+    SeqRanges::const_iterator f = ranges.find(name);
+    if (f == ranges.end()) continue;
+    file.get(i, seq);
+    writeRanges(out, n, seq.length, f->second, letters, text);
+  }
+}
+
+static void writeTextRanges(SegTextOutput &out, const SeqRanges &ranges,
+			    const char *fileName) {
+  std::ifstream ifs;
+  SeqReader reader(openIn(fileName, ifs));
+  SeqRecord r;
+  TextLetters letters = {r.seq};
+  std::string name, text;
+  while (reader.read(r)) {
+    StringView n = seqRecordName(r);
+    name.assign(n.begin(), n.end());
+    SeqRanges::const_iterator f = ranges.find(name);
+    if (f == ranges.end()) continue;
+    writeRanges(out, n, r.seq.size(), f->second, letters, text);
+  }
+}
+
+static void segSeq(size_t segmentNum, const char *segFileName,
+		   char **seqFileNames) {
+  SeqRanges ranges;
+  readSeqRanges(segFileName, segmentNum, ranges);
+  SegOutput output(std::cout);
+  for (char **i = seqFileNames; *i; ++i) {
+    if (isTwoBitFile(*i)) writeTwoBitRanges(output, ranges, *i);
+    else writeTextRanges(output, ranges, *i);
+  }
+  output.finish();
+}
+
+static void run(int argc, char **argv) {
+  size_t segmentNum = 1;
+
+  std::string prog = argv[0];
+  std::string help = "\
+Usage: " + prog + " [options] seg-file sequence-file(s)\n\
+\n\
+Get segments of sequences.  The sequence files can be fasta, fastq, or\n\
+UCSC .2bit.\n\
+\n\
+Options:\n\
+  -h, --help     show this help message and exit\n\
+  -V, --version  show version number and exit\n\
+  -n N           use the Nth segment in each segment-tuple (default=1)\n\
+";
+
+  const char sOpts[] = "hn:V";
+
+  static struct option lOpts[] = {
+    { "help",    no_argument, 0, 'h' },
+    { "version", no_argument, 0, 'V' },
+    { 0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, sOpts, lOpts, &c)) != -1) {
+    switch (c) {
+    case 'h':
+      std::cout << help;
+      return;
+    case 'n':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned n;
+	sv >> n;
+	if (!sv || n < 1) err("option -n: should be > 0");
+	segmentNum = n;
+      }
+      break;
+    case 'V':
+      std::cout << "seg-seq "
+#include "version.hh"
+        "\n";
+      return;
+    case '?':
+      std::cerr << help;
+      err("");
+    }
+  }
+
+  if (argc - optind < 2) {
+    std::cerr << help;
+    err("");
+  }
+
+  std::ios_base::sync_with_stdio(false);  // makes it faster!
+
+  segSeq(segmentNum, argv[optind], argv + optind + 1);
+}
+
+int main(int argc, char **argv) {
+  try {
+    run(argc, argv);
+    if (!std::cout.flush()) err("write error");
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    const char *s = e.what();
+    if (*s) std::cerr << argv[0] << ": " << s << '\n';
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,114 @@
+// Author: Martin C. Frith 2023
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Expand or shrink each segment-tuple at either end.  Don't expand
+// past coordinate 0, and omit segment-tuples whose length would become
+// negative.
+
+#include "mcf_seg_transform.hh"
+
+#include <getopt.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace mcf;
+
+static void segShift(long begGrowth, long endGrowth, char **fileNames) {
+  SegShiftTransform shifter(begGrowth, endGrowth);
+  SegOutput output(std::cout);
+  transformSegFiles(fileNames, shifter, output);
+  output.finish();
+}
+
+static long growthValue(const char *arg, char option) {
+  long x;
+  const char *e = arg + std::strlen(arg);
+  if (readLong(arg, e, x) != e)
+    err(std::string("option -") + option + ": bad value");
+  return x;
+}
+
+static void run(int argc, char **argv) {
+  bool isBeg = false;
+  bool isEnd = false;
+  bool isGrow = false;
+  long begGrowth = 0;
+  long endGrowth = 0;
+
+  std::string prog = argv[0];
+  std::string help = "\
+Usage: " + prog + " [options] seg-file(s)\n\
+\n\
+Expand or shrink each seg at either end.  Don't expand past coordinate 0,\n\
+and omit segs whose length would become negative.\n\
+\n\
+Options:\n\
+  -h, --help          show this help message and exit\n\
+  -V, --version       show version number and exit\n\
+  -b INT, --beg INT   expand by this amount at the 5'-end\n\
+  -e INT, --end INT   expand by this amount at the 3'-end\n\
+  -g INT, --grow INT  expand by this amount at both ends\n\
+";
+
+  const char sOpts[] = "hb:e:g:V";
+
+  static struct option lOpts[] = {
+    { "help",    no_argument,       0, 'h' },
+    { "version", no_argument,       0, 'V' },
+    { "beg",     required_argument, 0, 'b' },
+    { "end",     required_argument, 0, 'e' },
+    { "grow",    required_argument, 0, 'g' },
+    { 0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, sOpts, lOpts, &c)) != -1) {
+    switch (c) {
+    case 'h':
+      std::cout << help;
+      return;
+    case 'b':
+      begGrowth = growthValue(optarg, c);
+      isBeg = true;
+      break;
+    case 'e':
+      endGrowth = growthValue(optarg, c);
+      isEnd = true;
+      break;
+    case 'g':
+      begGrowth = endGrowth = growthValue(optarg, c);
+      isGrow = true;
+      break;
+    case 'V':
+      std::cout << "seg-shift "
+#include "version.hh"
+        "\n";
+      return;
+    case '?':
+      std::cerr << help;
+      err("");
+    }
+  }
+
+  if (isGrow && isBeg) err("can't combine -g and -b");
+  if (isGrow && isEnd) err("can't combine -g and -e");
+
+  std::ios_base::sync_with_stdio(false);  // makes it faster!
+
+  segShift(begGrowth, endGrowth, argv + optind);
+}
+
+int main(int argc, char **argv) {
+  try {
+    run(argc, argv);
+    if (!std::cout.flush()) err("write error");
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    const char *s = e.what();
+    if (*s) std::cerr << argv[0] << ": " << s << '\n';
+    return EXIT_FAILURE;
+  }
+}
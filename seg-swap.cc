@@ -0,0 +1,117 @@
+// Author: Martin C. Frith 2011
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Read segment-tuples in SEG format, and write them after swapping the
+// order of segments in each tuple.
+
+// Also, canonicalize strands, i.e. ensure that the first segment in
+// each tuple is on the forward strand, by flipping strands if
+// necessary.
+
+#include "mcf_seg_sort.hh"
+#include "mcf_seg_transform.hh"
+
+#include <getopt.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace mcf;
+
+static void segSwap(size_t segmentNum, bool isKeepStrands,
+		    size_t maxSortMemory, char **fileNames) {
+  SegSwapTransform swapper(segmentNum, isKeepStrands);
+  SegOutput output(std::cout);
+  std::unique_ptr<SegSortOutput> sorted;
+  if (maxSortMemory) sorted.reset(new SegSortOutput(output, maxSortMemory));
+  SegTextOutput &out = sorted ? *sorted : static_cast<SegTextOutput &>(output);
+  transformSegFiles(fileNames, swapper, out);
+  if (sorted) sorted->finish();
+  output.finish();
+}
+
+static void run(int argc, char **argv) {
+  size_t segmentNum = 2;
+  bool isKeepStrands = false;
+  bool isSort = false;
+  size_t maxSortMemory = 1UL << 30;
+
+  std::string prog = argv[0];
+  std::string help = "\
+Usage: " + prog + " [options] seg-file(s)\n\
+\n\
+Swap the order of segments in segment-tuples.\n\
+\n\
+Options:\n\
+  -h, --help     show this help message and exit\n\
+  -V, --version  show version number and exit\n\
+  -n N           swap the Nth segment with the first segment (default=2)\n\
+  -s             do not canonicalize strands\n\
+  -S             sort the output, in the same order as seg-sort\n\
+  -M SIZE        with -S: use at most about this much memory, then sort in\n\
+                 temporary files (default=1G)\n\
+";
+
+  const char sOpts[] = "hn:sSM:V";
+
+  static struct option lOpts[] = {
+    { "help",    no_argument, 0, 'h' },
+    { "version", no_argument, 0, 'V' },
+    { 0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, sOpts, lOpts, &c)) != -1) {
+    switch (c) {
+    case 'h':
+      std::cout << help;
+      return;
+    case 'n':
+      {
+	StringView sv(optarg, optarg + std::strlen(optarg));
+	unsigned n;
+	sv >> n;
+	if (!sv || n < 1) err("option -n: should be > 0");
+	segmentNum = n;
+      }
+      break;
+    case 's':
+      isKeepStrands = true;
+      break;
+    case 'S':
+      isSort = true;
+      break;
+    case 'M':
+      if (!readByteSize(optarg, maxSortMemory)) err("option -M: bad value");
+      break;
+    case 'V':
+      std::cout << "seg-swap "
+#include "version.hh"
+        "\n";
+      return;
+    case '?':
+      std::cerr << help;
+      err("");
+    }
+  }
+
+  std::ios_base::sync_with_stdio(false);  // makes it faster!
+
+  segSwap(segmentNum, isKeepStrands, isSort ? maxSortMemory : 0,
+	  argv + optind);
+}
+
+int main(int argc, char **argv) {
+  try {
+    run(argc, argv);
+    if (!std::cout.flush()) err("write error");
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    const char *s = e.what();
+    if (*s) std::cerr << argv[0] << ": " << s << '\n';
+    return EXIT_FAILURE;
+  }
+}
@@ -42,6 +42,11 @@ PATH=../bin:$PATH
     try seg-import -5 -3 -f2 gtf sp.gtf
     try seg-import gtf bad.gtf
 
+    try seg-import gff3 sp.gff3
+    try seg-import -c -f2 gff3 sp.gff3
+    try seg-import -i gff3 sp.gff3
+    try seg-import gff3 genomic.gff
+
     try seg-import lasttab a-top.tab
     try seg-import -a lasttab a-top.tab
     try seg-import -a -f2 lasttab a-top.tab
@@ -49,6 +54,14 @@ PATH=../bin:$PATH
     try seg-import maf a-top.maf
     try seg-import -a maf a-top.maf
     try seg-import -a -f2 maf a-top.maf
+    try seg-import -t2 -a maf a-top.maf
+    try seg-import -r chr -r 2/ -a maf a-top.maf
+    try "echo 'a:s hg.chr1 0 4 + 100 AC-GT:s mm.chr1 0 4 + 90 AC-GT:s cf.chr1 0 5 + 80 ACAGT:' |
+         awk -v RS=: 1 | seg-import -r hg -r mm -a maf -"
+    try "(ulimit -n 50 && mkdir shn && seq 100 199 | sed 's/.*/n& 0 10/' > many.bed &&
+         seg-import -o shn/ bed many.bed many.bed && ls shn | wc -l &&
+         cat shn/n199.seg) && rm -r shn many.bed"
+    try "seg-import -o shard -s3 sam a-top.sam && head shard?.seg && rm shard?.seg"
     try seg-import maf hg38Y-prot.maf
 
     try seg-import psl hg19-refSeqAli100.psl
@@ -61,6 +74,7 @@ PATH=../bin:$PATH
     try seg-import rmsk rmsk.txt
 
     try seg-import sam a-top.sam
+    try seg-import -F16 -q100 sam a-top.sam
     try seg-import -f2 sam a-top.sam
 
     try seg-join hg38Yrg.seg hg38Yaln3.seg
@@ -69,6 +83,9 @@ PATH=../bin:$PATH
     try seg-join -v1 hg38Ycgi.seg hg38Yrg.seg
     try seg-join -v1 -c1 hg38Ycgi.seg hg38Yrg.seg
     try seg-join -v2 hg38Yaln3.seg hg38Ycgi.seg
+    try seg-join -p hg38Yrg.seg hg38Yaln3.seg
+    try "awk 'NR % 2 {x = \$0; next} {print; print x}' hg38Yrg.seg |
+         seg-join -r1 hg38Ycgi.seg -"
     try seg-join -w hg38Yrg.seg hg38Yrg2.seg
     try seg-join -w -v2 hg38Yrg.seg hg38Yrg2.seg
     try seg-join -w -c1 -c2 hg38Yrg.seg hg38Yrg2.seg
@@ -78,16 +95,57 @@ PATH=../bin:$PATH
     try seg-join -n30 hg38Yrg.seg hg38Ycgi.seg
     try seg-join -n1/3 hg38Yrg.seg hg38Ycgi.seg
     try seg-join -x10 hg38Yrg.seg hg38Ycgi.seg
+    try seg-join -l hg38Yrg.seg hg38Ycgi.seg
+    try seg-join -t3 -f2 hg38Ycgi.seg hg38Yrg.seg
+    try "echo 30000000 chrY 0 | cat - hg38Yrg.seg > long.seg &&
+         seg-join -t4 -c1 hg38Ycgi.seg long.seg | tail -3 && rm long.seg"
+    try "echo bad | cat hg38Ycgi.seg - > bad.seg &&
+         seg-join -t3 bad.seg hg38Yrg.seg 2>&1 | tail -2 && rm bad.seg"
+    try "seg-join -M1 -d2 hg38Ycgi.seg hg38Yrg.seg 2> spill.txt &&
+         cat spill.txt && rm spill.txt"
+    try seg-join -w -d2 hg38Yrg.seg hg38Yrg2.seg
+    try seg-join -g2 hg38Ycgi.seg hg38Yaln3.seg
+    try "seg-join -o shard- -w hg38Yrg.seg hg38Yrg2.seg && head -3 shard-* &&
+         rm shard-*"
+    try "seg-join -u inc.seg -v1 hg38Ycgi.seg hg38Yrg.seg &&
+         seg-join -u inc.seg -v1 hg38Ycgi.seg hg38Yrg.seg &&
+         tail -n2 inc.seg inc.seg.sums && rm inc.seg*"
+    try "seg-join -k ck.seg hg38Ycgi.seg hg38Yrg.seg && echo junk >> ck.seg &&
+         seg-join -R -k ck.seg hg38Ycgi.seg hg38Yrg.seg &&
+         tail -n2 ck.seg ck.seg.ckpt && rm ck.seg*"
+    try "seg-join -K60 hg38Ycgi.seg hg38Yrg.seg 2>&1 | sed 's/.*: //'"
+    try "seg-join -m .out hg38Ycgi.seg hg38Yaln3.seg hg38Yrg.seg &&
+         head -3 hg38Ycgi.seg.out hg38Yaln3.seg.out &&
+         rm hg38Ycgi.seg.out hg38Yaln3.seg.out"
+    try "echo 'hg38Yrg.seg:300 chrY 281300::-n50 hg38Yrg.seg:300 chrY 281300::' |
+         awk -v RS=: 1 | seg-join -q hg38Yrg.seg"
+    try "echo '-f3 hg38Yrg.seg:' | awk -v RS=: 1 | seg-join -q hg38Yrg.seg"
+    try "echo '-ln 30 hg38Yrg.seg:300 chrY 281300::-v2 hg38Yrg.seg:' |
+         awk -v RS=: 1 | seg-join -q hg38Yrg.seg"
+    try "seg-import -k ck.seg -a psl te.psl && echo junk >> ck.seg &&
+         seg-import -R -k ck.seg -a psl te.psl &&
+         tail -n2 ck.seg ck.seg.ckpt && rm ck.seg*"
+    try "seg-import -b chain.segb chain hg19-hg38-1k.chain &&
+         seg-import chain hg19-hg38-1k.chain | seg-sort | cut -f-3 | head -3 |
+         seg-shift -g10 | seg-join - chain.segb && rm chain.segb"
+    try "cat hg38Yaln3.seg | seg-join hg38Yrg.seg /dev/stdin | head -3"
 
     try seg-mask chrM.seg chrM.fa
     try seg-mask -c chrM.seg chrM.fa
     try seg-mask -xn chrM.seg chrM.fa
+    try seg-mask -c chrM.seg chrM.2bit
 
     try seg-seq chrM.seg chrM.fa
+    try seg-seq -n1 chrM.seg chrM.2bit
+    try "head -3 chrM.seg | awk '{print \$1, \$2, -\$3-\$1}' |
+         seg-seq - chrM.2bit"
+
+    try "seg-shift -b30000000 -e-20 hg38Yaln3.seg | head -5"
 
     try seg-swap hg38Yaln3.seg
     try seg-swap -n3 hg38Yaln3.seg
     try seg-swap -s hg38Yaln3.seg
+    try "seg-swap -S -M1K -n3 hg38Yaln3.seg | head"
 
     try "cut -f-3 hg38Yrg.seg | seg-merge"
 } | diff -u seg-test.txt -
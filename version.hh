@@ -0,0 +1 @@
+"ormat:%d"